@@ -28,14 +28,38 @@
     by Guilherme Bartasson, Diego Batistuta e Vitor Teixeira, 2019
 */
 
+// Necessário para a dladdr()
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <ucontext.h>
 #include <stdlib.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <errno.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Campo da sigevent com a thread de destino dos sinais(SIGEV_THREAD_ID), ausente em glibcs antigas
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 typedef int fiber_t; // tipo para ID de fibers
+typedef struct Generator generator_t; // tipo opaco dos generators
 
 // Erros das funções
 #define ERR_EXISTS   11
@@ -45,10 +69,37 @@ typedef int fiber_t; // tipo para ID de fibers
 #define ERR_NOTFOUND 55
 #define ERR_JOINCRRT 66
 #define ERR_NULLID   77
+#define ERR_IO       88
+#define ERR_SIZE     99
+#define ERR_NOTREADY 110
+#define ERR_DONE     121
+#define ERR_AGAIN    132
+#define ERR_BUSY     143
 
 // Pilha de 64kB
 #define FIBER_STACK 1024*64
 
+// Tamanho máximo de um valor de retorno passado por valor(fiber_exit_value)
+#define FIBER_INLINE_RETVAL 16
+
+// Alinhamento dos blocos retornados pela fiber_alloc
+#define ARENA_ALIGN 16
+
+// Alinhamento da área reservada no topo da pilha pela fiber_create_closure
+#define CLOSURE_ALIGN 16
+
+// Quantidade máxima de pilhas livres mantidas para as fibers escolhidas por uma preempção
+#define STACK_RESERVE 4
+
+// Quantidade máxima de blocos de arenas guardados para reaproveitamento
+#define ARENA_POOL 32
+
+// Tamanho de uma linha de cache
+#define CACHE_LINE 64
+
+// Quantidade de cabeçalhos de fibers por bloco alocado
+#define FIBER_CHUNK 64
+
 // Id da thread principal
 #define PARENT_ID -1
 
@@ -60,6 +111,59 @@ typedef int fiber_t; // tipo para ID de fibers
 #define READY 1
 #define WAITING 0
 #define FINISHED -1
+#define OFFLOADED 2
+#define SUSPENDED 3
+#define PARKED 4
+
+// Intervalo mínimo entre duas publicações das métricas(100ms)
+#define METRICS_INTERVAL 100000000ull
+
+// Quantidade de listas de espera da fiber_wait(potência de 2)
+#define WAIT_BUCKETS 256
+
+// Quantidade de threads de kernel que executam as rotinas da fiber_offload
+#define OFFLOAD_THREADS 4
+
+// Tipos de eventos do tracer
+#define TRACE_CREATE     1
+#define TRACE_SWITCH_IN  2
+#define TRACE_SWITCH_OUT 3
+#define TRACE_EXIT       4
+#define TRACE_JOIN_BLOCK 5
+#define TRACE_WAKE       6
+
+// Motivos de um evento TRACE_SWITCH_OUT
+#define TRACE_PREEMPTED 1
+#define TRACE_JOINED    2
+#define TRACE_EXITED    3
+#define TRACE_OFFLOADED 4
+#define TRACE_HANDOFF   5
+#define TRACE_PARKED    6
+
+// Identificador dos arquivos gerados pela fiber_trace_dump
+#define TRACE_MAGIC "FIBTRACE"
+
+// Identificador da página publicada pela fiber_metrics_start
+#define METRICS_MAGIC "FIBMETRC"
+
+// Histogramas de latência do escalonador
+#define FIBER_LATENCY_READY 0 // De pronta até executar
+#define FIBER_LATENCY_JOIN  1 // Do término da fiber aguardada até o retorno do join
+#define FIBER_LATENCY_SLICE 2 // Tempo de relógio(não de CPU) de cada fatia de execução
+#define LATENCY_HISTOGRAMS  3
+
+// Sub-buckets por potência de 2 dos histogramas de latência(erro relativo de 1/16)
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+
+// Buckets dos histogramas de latência: medidas de até 2^44ns(cerca de 4,9 horas)
+#define LATENCY_BUCKETS (LATENCY_SUB * 41)
+
+// Profundidade máxima das pilhas amostradas pelo profiler
+#define PROFILE_DEPTH 32
+
+// Frames do tratador de sinal(profHandler e o trampolim do kernel) ignorados nas amostras
+#define PROFILE_SKIP 2
 
 /*
     Waiting
@@ -81,6 +185,109 @@ typedef struct Waiting{
     struct Waiting * next;   // Ponteiro para o próximo nodo
 }Waiting;
 
+/*
+    ArenaBlock
+    ----------
+
+    Bloco de memória de uma arena de fiber(fiber_alloc).
+    ***************************************************
+
+    Atributos:
+    +++++++++
+
+    - next: próximo bloco da mesma arena, ou do pool de blocos livres.
+
+    - size: quantidade de bytes em data.
+
+    - used: quantidade de bytes de data já alocados.
+
+    - data: memória do bloco, alocada junto com a struct.
+*/
+typedef struct ArenaBlock{
+    struct ArenaBlock * next; // Próximo bloco
+    size_t size;              // Tamanho de data
+    size_t used;              // Bytes já alocados
+    unsigned char data[];     // Memória do bloco
+}ArenaBlock;
+
+/*
+    FiberCold
+    ---------
+
+    Struct com os dados "frios" de uma fiber, isto é, os que não são
+    acessados pelo escalonador a cada troca de fibers.
+    *****************************************************************
+
+    Atributos:
+    +++++++++
+
+    - context: contexto da fiber. A estrutura ucontext_t ocupa cerca
+      de 1kB(registradores, estado de ponto flutuante e máscara de 
+      sinais), e por isso fica no topo da pilha da fiber, montada no 
+      primeiro despacho(ver materializeFiber). NULL enquanto a fiber 
+      não tem pilha. O da thread principal é o parentContext do runtime.
+
+    - retval e join_retval: ponteiros que armazenam os
+      endereços dos valores de retorno desta fiber e
+      da fiber que ela está esperando, respectivamente.
+
+    - waitingList: lista com id's das fibers que estão esperando
+      essa fiber em joins.
+
+    - routine e arg: rotina executada pela fiber(NULL para a thread
+      principal) e seu argumento. A rotina também é usada para 
+      identificar a fiber nas amostras do profiler.
+
+    - value e join_value: cópias dos valores de retorno passados
+      por valor(fiber_exit_value) por esta fiber e pela fiber que
+      ela está esperando, respectivamente.
+
+    - arena: blocos da arena da fiber, começando pelo bloco em uso.
+      NULL caso a fiber tenha sido criada sem arena.
+
+    - arenaSize: tamanho dos blocos da arena.
+
+    - joinable: diferente de zero enquanto a fiber, depois de terminada,
+      deve ser mantida na lista até que alguma fiber dê join nela ou 
+      ela seja desanexada com fiber_detach()(fibers criadas pela 
+      fiber_create_closure()).
+
+    - retvalTaken: diferente de zero quando alguma fiber já recebeu o
+      retval desta fiber em um join.
+
+    - dispose: rotina chamada com o retval da fiber quando ela é 
+      destruída sem que nenhuma fiber o tenha recebido. Pode ser NULL.
+
+    - generator: generator cujo produtor é esta fiber(NULL para as
+      fibers comuns).
+
+    - error e join_error: erro que impediu esta fiber de executar(ver
+      failFiber) e o da fiber que ela estava esperando, respectivamente.
+
+    - posted: diferente de zero quando o cabeçalho e os dados frios da
+      fiber estão no bloco de uma tarefa da fiber_post()(PostedTask),
+      liberado de uma só vez na destruição da fiber.
+*/
+typedef struct FiberCold{
+    ucontext_t * context;     // Contexto da fiber
+    void * retval;            // valor de retorno da fiber
+    void * join_retval;       // valor de retorno da fiber que ela estava esperando
+    Waiting * waitingList;    // Lista de fibers que estão esperando essa fiber
+    void *(*routine)(void *); // Rotina da fiber
+    void * arg;               // Argumento da rotina
+    unsigned char value[FIBER_INLINE_RETVAL];      // valor de retorno inline da fiber
+    unsigned char join_value[FIBER_INLINE_RETVAL]; // valor de retorno inline da fiber que ela estava esperando
+    ArenaBlock * arena;       // Arena da fiber
+    size_t arenaSize;         // Tamanho dos blocos da arena
+    int joinable;             // Mantida na lista até ser aguardada
+    int retvalTaken;          // retval já recebido por um join
+    void (*dispose)(void *);  // Destrói um retval não recebido
+    struct Generator * generator; // Generator produzido pela fiber
+    int error;                // Erro que impediu a fiber de executar
+    int join_error;           // Erro da fiber que ela estava esperando
+    int posted;               // Alocada pela fiber_post
+}FiberCold;
+
 /*
     Fiber
     -----
@@ -88,44 +295,187 @@ typedef struct Waiting{
     Struct de uma fiber(thread de user-level).
     *****************************************
 
+    Contém apenas os campos usados pelo escalonador e pela findFiber(), 
+    e ocupa exatamente uma linha de cache. Os cabeçalhos são alocados 
+    em blocos contíguos(FiberChunk), para que a varredura da lista 
+    circular não precise buscar uma linha de cache espalhada pela heap 
+    para cada fiber.
+
     Atributos:
     +++++++++
 
     - next e prev: ponteiros para outras estruturas
       de fibers para que seja feita uma lista circular.
 
-    - context: ponteiro para a estrutura ucontext_t
-      que contém o contexto da fiber.
-
     - status: representa o estado atual da fiber: 
         READY: fiber ativa/pronta para ser executada;
         WAITING: esperando outra fiber com join;
         FINISHED: fiber terminada;
+        OFFLOADED: esperando uma rotina da fiber_offload;
+        SUSPENDED: produtor de um generator esperando o
+          consumidor pedir o próximo valor;
+        PARKED: bloqueada na fiber_wait até uma fiber_wake
+          no mesmo endereço;
     
     - fiberId: id inteiro da fiber.
       O id da thread principal é PARENT_ID.
-
-    - retval e join_retval: ponteiros que armazenam os
-      endereços dos valores de retorno desta fiber e
-      da fiber que ela está esperando, respectivamente.
     
     - joinFiber: ponteiro para a fiber que essa fiber 
-      está esperando.
+      está esperando. Volta a ser NULL quando a fiber
+      aguardada é liberada pela releaseFibers().
 
-    - waitingList: lista com id's das fibers que estão esperando
-      essa fiber em joins.
+    - cold: ponteiro para os dados frios da fiber(contexto,
+      valores de retorno e lista de espera).
+
+    - readySince: instante em que a fiber ficou pronta para executar,
+      ou zero caso ela esteja executando, não esteja esperando a CPU ou
+      as medidas de latência estejam desligadas.
+
+    - joinWoken: diferente de zero caso a fiber tenha ficado pronta
+      pelo término da fiber que ela aguardava em um join.
 */
 typedef struct Fiber{
     struct Fiber * next;      // Próxima fiber da lista
     struct Fiber * prev;      // Fiber anterior
-    ucontext_t context;       // Contexto da fiber
     int status;               // Status atual da fiber
     fiber_t fiberId;          // Id da fiber
-    void * retval;            // valor de retorno da fiber
-    void * join_retval;       // valor de retorno da fiber que ela estava esperando
     struct Fiber * joinFiber; // Ponteiro para a fiber que essa fiber está esperando
-    Waiting * waitingList;    // Lista de fibers que estão esperando essa fiber
-}Fiber;
+    FiberCold * cold;         // Dados frios da fiber
+    uint64_t readySince;      // Instante em que ficou pronta
+    int joinWoken;            // Acordada pelo término de um join
+} __attribute__((aligned(CACHE_LINE))) Fiber;
+
+/*
+    FiberChunk
+    ----------
+
+    Bloco contíguo de cabeçalhos de fibers.
+    **************************************
+
+    Atributos:
+    +++++++++
+
+    - next: ponteiro para o próximo bloco alocado.
+
+    - fibers: vetor de FIBER_CHUNK cabeçalhos alinhados à linha de cache.
+*/
+typedef struct FiberChunk{
+    struct FiberChunk * next;    // Próximo bloco
+    Fiber fibers[FIBER_CHUNK];   // Cabeçalhos das fibers
+}FiberChunk;
+
+/*
+    FiberSpec
+    ---------
+
+    Opções de criação de uma fiber, usadas internamente pelas variações
+    da fiber_create().
+    ******************************************************************
+
+    Atributos:
+    +++++++++
+
+    - arenaSize: tamanho dos blocos da arena da fiber(zero para uma 
+      fiber sem arena).
+
+    - storageSize, init e ctx: tamanho da área reservada no topo da 
+      pilha da fiber e rotina chamada com o endereço dela e ctx antes
+      que a fiber seja inserida na lista. O endereço da área é passado
+      como argumento para a rotina da fiber. storageSize é zero para 
+      fibers sem essa área.
+
+    - dispose: rotina que destrói um retval não recebido por nenhum join.
+      Caso não seja NULL, a fiber também é criada como joinable.
+
+    - nonBlocking: diferente de zero para que a criação retorne 
+      ERR_BUSY, ao invés de esperar, quando os limites do controle de
+      admissão estiverem atingidos.
+
+    - admitted: diferente de zero caso a vaga no controle de admissão
+      já tenha sido reservada pela admitFiber(), antes de uma seção com
+      a preempção adiada, na qual a criação não pode esperar. A vaga é
+      devolvida pela createFiber() em qualquer caso.
+*/
+typedef struct FiberSpec{
+    size_t arenaSize;                     // Tamanho dos blocos da arena
+    size_t storageSize;                   // Área no topo da pilha
+    void (*init)(void *, void *);         // Inicializa a área
+    void * ctx;                           // Argumento da init
+    void (*dispose)(void *);              // Destrói o retval
+    int nonBlocking;                      // Recusa ao invés de esperar
+    int admitted;                         // Vaga já reservada
+}FiberSpec;
+
+/*
+    Generator
+    ---------
+
+    Estado de um generator(generator_create). O produtor é uma fiber 
+    comum, que fica com status SUSPENDED(e é pulada pelo escalonador)
+    enquanto o consumidor não pede o próximo valor. O consumidor fica 
+    SUSPENDED enquanto o produtor executa. A CPU é passada diretamente
+    de um para o outro, sem passar pelo escalonador e sem mexer no 
+    timer: o produtor executa no timeslice do consumidor.
+    ****************************************************************
+
+    Atributos:
+    +++++++++
+
+    - producer: fiber produtora.
+
+    - consumer: fiber que chamou a generator_next() pela última vez.
+
+    - routine e arg: rotina do produtor e seu argumento.
+
+    - value: último valor passado para a fiber_yield_value().
+
+    - done: diferente de zero depois que o produtor termina. A partir
+      daí, producer não deve mais ser acessado.
+*/
+typedef struct Generator{
+    Fiber * producer;          // Fiber produtora
+    Fiber * consumer;          // Fiber consumidora
+    void *(*routine)(void *);  // Rotina do produtor
+    void * arg;                // Argumento da rotina
+    void * value;              // Último valor produzido
+    int done;                  // Produtor terminado
+}Generator;
+
+/*
+    WaitNode
+    --------
+
+    Nodo de uma fiber parada na fiber_wait(). Fica na pilha da própria
+    fiber, que não executa até ser acordada, e por isso a espera não 
+    faz nenhuma alocação.
+    *****************************************************************
+
+    Atributos:
+    +++++++++
+
+    - addr: endereço no qual a fiber está esperando.
+
+    - fiber: fiber parada.
+
+    - next: próximo nodo da mesma lista de espera.
+*/
+typedef struct WaitNode{
+    int * addr;               // Endereço esperado
+    Fiber * fiber;            // Fiber parada
+    struct WaitNode * next;   // Próximo nodo
+}WaitNode;
+
+/*
+    WaitBucket
+    ----------
+
+    Lista de espera(FIFO) das fibers paradas em endereços cujo hash 
+    cai nesta posição da tabela.
+*/
+typedef struct WaitBucket{
+    WaitNode * head;          // Primeira fiber parada
+    WaitNode * tail;          // Última fiber parada
+}WaitBucket;
 
 /*
     FiberList
@@ -148,661 +498,4222 @@ typedef struct Fiber{
 
     - started: inteiro que indica se o timer e o escalonador já
       começaram.
+
+    - nextId: próximo id a ser atribuído a uma fiber. Ids nunca são
+      reaproveitados, mesmo que o cabeçalho da fiber seja.
+
+    - chunks: lista dos blocos de cabeçalhos alocados.
+
+    - freeFibers: lista(encadeada pelo ponteiro next) de cabeçalhos
+      livres para serem reaproveitados.
+
+    - freeArenas e nFreeArenas: blocos de arenas de fibers destruídas,
+      guardados para serem reaproveitados, e a quantidade deles(no
+      máximo ARENA_POOL).
 */
 typedef struct FiberList{
     Fiber * fibers;             // Lista de fibers
     Fiber * currentFiber;       // Fiber sendo executada no momento
     int nFibers;                // Quantidade de fibers na lista
     int started;                // Indica se as fibers estão rodando
+    fiber_t nextId;             // Próximo id de fiber
+    FiberChunk * chunks;        // Blocos de cabeçalhos alocados
+    Fiber * freeFibers;         // Cabeçalhos livres
+    ArenaBlock * freeArenas;    // Blocos de arenas livres
+    int nFreeArenas;            // Quantidade de blocos livres
 }FiberList;
 
-// Lista global que armazenará as fibers
-FiberList * f_list = NULL;
+/*
+    TraceEvent
+    ----------
+
+    Struct de tamanho fixo(16 bytes) de um evento de escalonamento
+    registrado pelo tracer.
+    *************************************************************
+
+    Atributos:
+    +++++++++
+
+    - timestamp: instante do evento, em ticks do rdtsc(x86) ou em
+      nanossegundos do CLOCK_MONOTONIC(outras arquiteturas). A
+      conversão para nanossegundos é feita com os valores de 
+      calibração da TraceHeader.
 
-// Contexto para a função de escalonamento e da thread principal
-ucontext_t schedulerContext, parentContext;
+    - fiberId: id da fiber a que o evento se refere.
 
-// Timer do escalonador
-struct itimerval timer;
+    - type: tipo do evento(TRACE_CREATE, TRACE_SWITCH_IN, ...).
 
+    - reason: motivo de um TRACE_SWITCH_OUT(TRACE_PREEMPTED,
+      TRACE_JOINED, TRACE_EXITED, TRACE_OFFLOADED, TRACE_HANDOFF
+      ou TRACE_PARKED). Zero para os demais eventos.
+*/
+typedef struct TraceEvent{
+    uint64_t timestamp;       // Instante do evento
+    int32_t fiberId;          // Fiber do evento
+    uint16_t type;            // Tipo do evento
+    uint16_t reason;          // Motivo da troca de contexto
+}TraceEvent;
 
 /*
-    timeHandler
+    TraceHeader
     -----------
 
-    Tratador do sinal SIGVTALRM, recebido sempre que o timer virtual é zerado.
-    Serve apenas para salvar o contexto da fiber atual e trocar o contexto para
-    a "fiber" do escalonador.
+    Cabeçalho dos arquivos gerados pela fiber_trace_dump(), seguido
+    por nEvents structs TraceEvent, da mais antiga para a mais nova.
+    ***************************************************************
+
+    Atributos:
+    +++++++++
 
+    - magic: TRACE_MAGIC, sem o '\0'.
 
+    - nEvents: quantidade de eventos no arquivo.
+
+    - lost: quantidade de eventos sobrescritos no buffer circular
+      antes de serem salvos.
+
+    - ticksStart, nsStart, ticksEnd e nsEnd: pares de leituras do
+      relógio do tracer e do CLOCK_MONOTONIC feitas no início do 
+      trace e na sua gravação, usados para converter os timestamps
+      para nanossegundos.
 */
-void timeHandler(){
-    if(swapcontext(&f_list->currentFiber->context, &schedulerContext) == -1){
-    	perror("Ocorreu um erro no swapcontext da timeHandler");
-    	return;
-    }
-}
+typedef struct TraceHeader{
+    char magic[8];            // Identificador do arquivo
+    uint64_t nEvents;         // Quantidade de eventos
+    uint64_t lost;            // Eventos perdidos
+    uint64_t ticksStart;      // Relógio do tracer no início
+    uint64_t nsStart;         // CLOCK_MONOTONIC no início
+    uint64_t ticksEnd;        // Relógio do tracer na gravação
+    uint64_t nsEnd;           // CLOCK_MONOTONIC na gravação
+}TraceHeader;
 
 /*
-    stopTimer
+    FiberMetrics
     ------------
 
-    Salva os segundos e microsegundos restantes do timer atual
-    na estrutura apontada por restored, e para o timer atual.
-    Caso restored seja NULL, apenas para o timer.
+    Página de métricas publicada pela fiber_metrics_start() em um 
+    segmento de memória compartilhada(/dev/shm), para ser lida por 
+    outros processos(como o fibertop).
+    **************************************************************
 
-*/
-void stopTimer(struct itimerval * restored){
-    // Se restored for NULL, não é pra restaurar. 
-    // Caso não seja, salva o tempo restante atual no ponteiro restored.
-    if(restored != NULL) 
-        if (getitimer(ITIMER_VIRTUAL, restored) == -1) {
-            perror("erro na getitimer() da stopTimer");
-            exit(1);
-        }
-    // Zerando segundos e microssegundos
-    timer.it_value.tv_sec = 0;
-    timer.it_value.tv_usec = 0;
+    Atributos:
+    +++++++++
 
-    // Parando o timer
-    if(setitimer (ITIMER_VIRTUAL, &timer, NULL) == -1){
-    	perror("Ocorreu um erro no setitimer() da stopTimer");
-    	return;
-    }
-}
+    - magic: METRICS_MAGIC, sem o '\0'.
 
-/*
-    restoreTimer
-    ------------
+    - seq: contador do seqlock. É ímpar enquanto a página está sendo
+      escrita: o leitor deve copiar a página entre duas leituras iguais
+      e pares de seq.
 
-    Seta o timer com os valores obtidos pela estrutura apontada
-    por restored.
+    - pid: processo que publica a página.
 
-*/
-void restoreTimer(struct itimerval * restored){
-    // Restaurando o timer para o restante do timeslice
-    if(setitimer (ITIMER_VIRTUAL, restored, NULL) == -1){
-    	perror("Ocorreu um erro no setitimer da restoreTimer");
-    	return;
-    }
-}
+    - timestamp: CLOCK_MONOTONIC da última publicação, em nanossegundos.
 
-/*
-    findFiber
-    ---------
+    - liveFibers: fibers na lista, incluindo a thread principal.
 
-    Função que retorna o endereço de memória que guarda a fiber que corresponde
-    ao id recebido "fiberId". Caso nenhuma fiber com esse id seja encontrada na
-    lista, a função retornará NULL.
+    - readyFibers: fibers prontas para executar(tamanho da fila de prontas).
+
+    - joinWaiting: fibers esperando outras em um join.
+
+    - switches: trocas de fiber desde o início.
+
+    - switchesPerSec: trocas por segundo desde a publicação anterior.
+
+    - preemptions: fibers interrompidas pelo timer desde o início.
+
+    - stackBytes: bytes de pilha alocados para as fibers e o escalonador.
+
+    - stopped: diferente de zero depois que a publicação terminou(pela 
+      fiber_metrics_stop() ou pelo fim das fibers): os contadores são os
+      finais, e a página não será mais atualizada.
 */
-Fiber * findFiber(fiber_t fiberId){
-    
-    int i;
-    Fiber * fiber; 
-    
-    // Caso não haja lista de fibers ainda
-    if(f_list == NULL)
-        return NULL;
+typedef struct FiberMetrics{
+    char magic[8];            // Identificador da página
+    uint64_t seq;             // Contador do seqlock
+    uint64_t pid;             // Processo publicador
+    uint64_t timestamp;       // Instante da publicação
+    uint64_t liveFibers;      // Fibers existentes
+    uint64_t readyFibers;     // Fibers prontas
+    uint64_t joinWaiting;     // Fibers em join
+    uint64_t switches;        // Trocas de fiber
+    uint64_t switchesPerSec;  // Trocas por segundo
+    uint64_t preemptions;     // Preempções pelo timer
+    uint64_t stackBytes;      // Bytes de pilha em uso
+    uint64_t stopped;         // Publicação terminada
+}FiberMetrics;
 
-    // Obtendo a primeira fiber da lista de fibers
-    fiber = (Fiber *) f_list->fibers;
+/*
+    FiberLatency
+    ------------
 
-    // Se não estiver inicializado
-    if(fiberId == 0)
-        return NULL;
+    Resumo de um histograma de latência do escalonador, obtido pela
+    fiber_latency_stats(). Os percentis têm erro relativo de no 
+    máximo 1/16(6,25%), e nunca são maiores que max.
+    **************************************************************
 
-    // Se for o id da thread principal, retorná-la
-    if(f_list->fibers->fiberId == fiberId)
-        return f_list->fibers;
+    Atributos:
+    +++++++++
 
-    // Se for o id da thread atual, retorná-la
-    if(f_list->currentFiber->fiberId == fiberId)
-        return f_list->currentFiber;
+    - count: quantidade de medidas desde o último reset.
 
-    // Procurando a fiber com o id recebido
-    for(i = 0; i < f_list->nFibers; i++){ 
-        fiber = (Fiber *) fiber->next;
-        if(fiber->fiberId == fiberId)
-            break;
-    }
+    - p50, p99 e p999: percentis 50, 99 e 99,9, em nanossegundos.
 
-    // Caso a fiber não tenha sido encontrada
-    if(i == f_list->nFibers) 
-        return NULL;
-    else return fiber; // Caso tenha sido encontrada, retorne a fiber
-}
+    - max: maior medida desde o último reset, em nanossegundos.
+*/
+typedef struct FiberLatency{
+    uint64_t count;           // Quantidade de medidas
+    uint64_t p50;             // Mediana
+    uint64_t p99;             // Percentil 99
+    uint64_t p999;            // Percentil 99,9
+    uint64_t max;             // Maior medida
+}FiberLatency;
 
 /*
-    releaseFibers
-    -------------
+    Tracer
+    ------
 
-    Função que libera todas as fibers da waitingList num join para
-    que sejam executadas no escalonador, libera a memória alocada 
-    dos nodos da waitingList e também instancia o join_retval de 
-    cada uma das fibers corretamente.
+    Estado do tracer de escalonamento.
+    *********************************
+
+    Atributos:
+    +++++++++
+
+    - events: buffer circular pré-alocado de eventos. NULL enquanto
+      o tracer estiver desligado.
+
+    - mask: capacidade do buffer menos um(a capacidade é sempre uma
+      potência de 2).
+
+    - next: quantidade total de eventos registrados desde o início.
+
+    - ticksStart e nsStart: leituras dos relógios no início do trace.
 */
-void releaseFibers(Waiting *waitingList){
-    // Enquanto houver fibers esperando
-    while(waitingList != NULL){
-        // Recebe o próximo nodo da lista
-        Waiting * waitingNode = waitingList->next; 
-        // Procura a fiber com o id do nodo atual da waitingList
-        Fiber * waitingFiber = findFiber(waitingList->waitingId); 
-        // Se a fiber existir e estiver esperando
-        if(waitingFiber != NULL && waitingFiber->status == WAITING){
-            // Libera a fiber
-            waitingFiber->status = READY;  
-            // Guarda o retval
-            waitingFiber->join_retval = waitingFiber->joinFiber->retval; 
-        } 
-        // Libera o nodo no topo
-        free(waitingList); 
-        // Vai para o próximo nodo
-        waitingList = (Waiting *) waitingNode; 
-    }
-    
-}
+typedef struct Tracer{
+    TraceEvent * events;      // Buffer circular de eventos
+    uint64_t mask;            // Capacidade do buffer - 1
+    uint64_t next;            // Total de eventos registrados
+    uint64_t ticksStart;      // Relógio do tracer no início
+    uint64_t nsStart;         // CLOCK_MONOTONIC no início
+}Tracer;
 
 /*
-    fiber_destroy
+    ProfileSample
     -------------
 
-    Libera a memória que foi alocada no endereço apontado por "fiber",
-    libera a memória que foi alocada para a pilha do contexto da fiber,
-    e reorganiza os nodos da lista de fibers.
+    Amostra do profiler: a fiber que estava executando quando o sinal
+    SIGPROF chegou e a pilha de chamadas dela.
+    ****************************************************************
+
+    Atributos:
+    +++++++++
+
+    - ready: diferente de zero quando a amostra foi completamente escrita.
+
+    - fiberId e routine: id e rotina da fiber amostrada.
 
+    - depth: quantidade de endereços em frames.
+
+    - frames: endereços de retorno da pilha, do mais interno para o 
+      mais externo.
 */
-Fiber * fiber_destroy(Fiber * fiber){
+typedef struct ProfileSample{
+    int ready;                      // Amostra completa
+    fiber_t fiberId;                // Fiber amostrada
+    void *(*routine)(void *);       // Rotina da fiber
+    int depth;                      // Profundidade da pilha
+    void * frames[PROFILE_DEPTH];   // Pilha de chamadas
+}ProfileSample;
 
-    // Erro, o ponteiro fiber aponta para NULL
-    if(fiber == NULL)
-        return NULL;
+/*
+    Profiler
+    --------
 
-    int id = fiber->fiberId;
+    Estado do profiler por amostragem.
+    *********************************
+
+    Atributos:
+    +++++++++
+
+    - samples: buffer pré-alocado de amostras. As posições são 
+      reservadas pelo tratador do sinal com um incremento atômico,
+      sem locks.
+
+    - capacity: quantidade de amostras que cabem no buffer.
+
+    - next: próxima posição livre do buffer. Pode passar de capacity,
+      e nesse caso as amostras excedentes são descartadas.
+*/
+typedef struct Profiler{
+    ProfileSample * samples;  // Buffer de amostras
+    unsigned long capacity;   // Capacidade do buffer
+    unsigned long next;       // Próxima posição livre
+}Profiler;
+
+/*
+    Metrics
+    -------
+
+    Contadores do runtime e estado da publicação das métricas.
+    *********************************************************
+
+    Atributos:
+    +++++++++
+
+    - page: página mapeada do segmento compartilhado(NULL enquanto as
+      métricas não são publicadas).
+
+    - name: nome do segmento(shm_open).
+
+    - switches, preemptions e stackBytes: contadores mantidos sempre,
+      copiados para a página a cada publicação.
+
+    - lastPublish e lastSwitches: instante e quantidade de trocas da
+      publicação anterior, usados para o limite de frequência e para
+      o cálculo das trocas por segundo.
+*/
+typedef struct Metrics{
+    FiberMetrics * page;      // Página compartilhada
+    char name[64];            // Nome do segmento
+    uint64_t switches;        // Trocas de fiber
+    uint64_t preemptions;     // Preempções pelo timer
+    uint64_t stackBytes;      // Bytes de pilha em uso
+    uint64_t lastPublish;     // Instante da última publicação
+    uint64_t lastSwitches;    // Trocas na última publicação
+}Metrics;
+
+/*
+    Histogram
+    ---------
+
+    Histograma de latência com buckets logarítmicos(no estilo do 
+    HdrHistogram): cada potência de 2 é dividida em LATENCY_SUB 
+    buckets lineares, de forma que o erro relativo de cada medida é
+    limitado, qualquer que seja a sua escala. Registrar uma medida 
+    custa apenas um incremento.
+    ***************************************************************
+
+    Atributos:
+    +++++++++
+
+    - counts: quantidade de medidas em cada bucket(ver latencyBucket).
+
+    - total: quantidade total de medidas.
+
+    - max: maior medida registrada, em nanossegundos.
+*/
+typedef struct Histogram{
+    uint64_t counts[LATENCY_BUCKETS]; // Medidas por bucket
+    uint64_t total;                   // Total de medidas
+    uint64_t max;                     // Maior medida
+}Histogram;
+
+/*
+    OffloadJob
+    ----------
+
+    Struct de uma rotina bloqueante enviada para as threads auxiliares
+    pela fiber_offload(). Fica na pilha da fiber que a enviou, que não
+    executa até a rotina terminar.
+    *****************************************************************
+
+    Atributos:
+    +++++++++
+
+    - routine e arg: rotina a ser executada e seu argumento.
+
+    - result: valor retornado pela rotina.
+
+    - fiber: fiber que está esperando a rotina.
+
+    - next: próximo job da fila de pendentes ou de concluídos.
+*/
+typedef struct OffloadJob{
+    void *(*routine)(void *); // Rotina bloqueante
+    void * arg;               // Argumento da rotina
+    void * result;            // Valor de retorno da rotina
+    struct Fiber * fiber;     // Fiber que está esperando
+    struct OffloadJob * next; // Próximo job
+}OffloadJob;
+
+/*
+    OffloadPool
+    -----------
+
+    Estado das threads auxiliares da fiber_offload().
+    ************************************************
+
+    Atributos:
+    +++++++++
+
+    - threads e nThreads: threads auxiliares criadas. Elas só são 
+      criadas no primeiro uso da fiber_offload().
+
+    - lock e cond: mutex que protege as filas e variável de condição
+      na qual as threads auxiliares esperam por jobs.
+
+    - jobs e jobsTail: fila de jobs pendentes.
+
+    - done: lista de jobs concluídos, ainda não vistos pelo escalonador.
+
+    - eventFd: eventfd sinalizado a cada job concluído, pelo qual o
+      escalonador é avisado(e espera, quando não há fibers prontas).
+
+    - pending: quantidade de fibers esperando jobs. Só é acessado pela
+      thread das fibers.
+
+    - stopping: diferente de zero quando o runtime está terminando e
+      as threads auxiliares devem sair.
+*/
+typedef struct OffloadPool{
+    pthread_t threads[OFFLOAD_THREADS]; // Threads auxiliares
+    int nThreads;                       // Quantidade de threads criadas
+    pthread_mutex_t lock;               // Mutex das filas
+    pthread_cond_t cond;                // Condição de novos jobs
+    OffloadJob * jobs;                  // Jobs pendentes
+    OffloadJob * jobsTail;              // Último job pendente
+    OffloadJob * done;                  // Jobs concluídos
+    int eventFd;                        // Aviso de jobs concluídos
+    int pending;                        // Fibers esperando jobs
+    int stopping;                       // Threads auxiliares devem sair
+}OffloadPool;
+
+/*
+    PostedTask
+    ----------
+
+    Tarefa enviada por outra thread com a fiber_post(). O produtor já
+    aloca o cabeçalho e os dados frios da fiber da tarefa, em um único
+    bloco: o escalonador apenas a insere na lista, sem alocações, o que
+    pode ser feito inclusive dentro do tratador do timer. O bloco é 
+    liberado quando a fiber é destruída(ver freeFiber).
+    ******************************************************************
+
+    Atributos:
+    +++++++++
+
+    - fiber: cabeçalho da fiber da tarefa.
+
+    - cold: dados frios da fiber, com a rotina e o argumento da tarefa.
+
+    - next: próxima tarefa da fila.
+*/
+typedef struct PostedTask{
+    Fiber fiber;               // Cabeçalho da fiber
+    FiberCold cold;            // Dados frios da fiber
+    struct PostedTask * next;  // Próxima tarefa
+}PostedTask;
+
+/*
+    PostQueue
+    ---------
+
+    Fila de tarefas da fiber_post(), com vários produtores(quaisquer
+    threads) e um único consumidor(o escalonador).
+    ***************************************************************
+
+    Atributos:
+    +++++++++
+
+    - owner: runtime que executa as tarefas, o da primeira thread que
+      começou a executar fibers. Volta a ser NULL quando ele termina,
+      e o próximo runtime iniciado passa a ser o dono da fila.
+
+    - head: pilha lock-free na qual os produtores inserem as tarefas
+      com um único compare-and-swap. O escalonador retira todas de uma
+      vez com um exchange e inverte a pilha para obter a ordem de envio.
+
+    - sleeping: diferente de zero enquanto o escalonador dono da fila
+      está esperando por eventos. Só nesse caso os produtores precisam
+      avisá-lo, escrevendo no eventFd.
+
+    - eventFd: eventfd pelo qual o escalonador dono da fila é acordado.
+      É criado por ele antes da primeira espera e nunca é fechado, já 
+      que os produtores não sabem quando o dono termina.
+
+    - backlog e backlogTail: tarefas já retiradas de head, em ordem de
+      envio, cujas fibers ainda não puderam ser inseridas por causa dos
+      limites do controle de admissão. Só são acessados pela thread do
+      runtime dono da fila.
+*/
+typedef struct PostQueue{
+    _Atomic(struct FiberRuntime *) owner; // Runtime que executa as tarefas
+    _Atomic(PostedTask *) head;  // Tarefas recém-enviadas(em ordem inversa)
+    atomic_int sleeping;         // Escalonador esperando no eventFd
+    int eventFd;                 // Aviso de novas tarefas
+    PostedTask * backlog;        // Tarefas retiradas ainda não criadas
+    PostedTask * backlogTail;    // Última tarefa retirada
+}PostQueue;
+
+/*
+    Admission
+    ---------
+
+    Estado do controle de admissão de um runtime, configurado pela
+    fiber_set_limits(). Cada fiber viva(criada e ainda não destruída,
+    sem contar a própria thread) ocupa uma vaga e reserva FIBER_STACK
+    bytes de pilha, mesmo antes de ser materializada.
+    ****************************************************************
+
+    Atributos:
+    +++++++++
+
+    - maxFibers e maxStackBytes: limites de fibers vivas e de bytes de
+      pilha reservados(zero para sem limite).
+
+    - admitted: fibers admitidas que ainda não foram inseridas na lista.
+
+    - released: contador de vagas liberadas. É o endereço no qual as
+      criações bloqueadas esperam com a fiber_wait().
+
+    - waiting: quantidade de criações bloqueadas esperando vagas.
+*/
+typedef struct Admission{
+    int maxFibers;            // Limite de fibers vivas
+    size_t maxStackBytes;     // Limite de bytes de pilha
+    int admitted;             // Admitidas ainda fora da lista
+    int released;             // Vagas liberadas
+    int waiting;              // Criações esperando vagas
+}Admission;
+
+/*
+    FiberRuntime
+    ------------
+
+    Estado de um escalonador M:1. Cada thread que cria fibers tem o seu
+    próprio runtime, alocado no primeiro uso(ver getRuntime) e apontado
+    por uma variável thread-local: as fibers de uma thread só executam
+    nela, e os escalonadores de threads diferentes não compartilham
+    nenhum estado(a não ser o profiler e a fila da fiber_post, que 
+    pertence a um único runtime). O runtime é destruído quando a thread
+    termina(ver destroyRuntime).
+    *******************************************************************
+
+    Atributos:
+    +++++++++
+
+    - f_list: lista das fibers da thread(NULL até a primeira fiber
+      ser criada).
+
+    - schedulerContext e parentContext: contextos do escalonador e da
+      thread.
+
+    - fiberTemplate: contexto capturado uma única vez, na criação do
+      runtime, copiado para o topo da pilha de cada fiber no primeiro
+      despacho. Assim, a criação de uma fiber não faz chamadas de 
+      sistema, e a cópia tem um estado de ponto flutuante válido para
+      a primeira troca para a fiber.
+
+    - timerId e timer: timer do tempo de CPU da thread, que envia o 
+      SIGVTALRM apenas para ela, e o timeslice programado nele.
+
+    - tracer e metrics: tracer de escalonamento e contadores da thread.
+
+    - preemptDeferred e preemptPending: preempção adiada. Enquanto 
+      preemptDeferred for diferente de zero, o tratador do timer apenas
+      marca preemptPending, e a preempção ocorre ao fim da seção.
+
+    - waitTable: listas de espera da fiber_wait.
+
+    - latency e sliceStart: histogramas de latência do escalonador(NULL
+      enquanto as medidas estão desligadas, ver fiber_latency_start) e
+      instante em que a fiber atual começou a executar.
+
+    - offload: threads auxiliares da fiber_offload.
+
+    - admission: limites e estado do controle de admissão.
+
+    - spareStacks e nSpareStacks: reserva de pilhas livres, encadeadas
+      pela primeira palavra de cada uma. É a única fonte de pilhas dentro
+      do tratador do timer, onde a malloc() não pode ser chamada, e é 
+      reposta nas trocas fora dele(ver stackTarget).
+
+    - lazyFibers: fibers na lista cuja pilha ainda não foi montada.
+
+    - exitContext e exiting: contexto salvo pela fiber_exit() da própria
+      thread(que não é a principal), retomado pelo escalonador para que
+      a thread termine na sua pilha original quando todas as suas fibers
+      terminam.
+*/
+typedef struct FiberRuntime{
+    FiberList * f_list;                       // Lista de fibers
+    ucontext_t schedulerContext;              // Contexto do escalonador
+    ucontext_t parentContext;                 // Contexto da thread
+    ucontext_t fiberTemplate;                 // Contexto modelo das fibers
+    timer_t timerId;                          // Timer do escalonador
+    struct itimerspec timer;                  // Timeslice do timer
+    Tracer tracer;                            // Tracer de escalonamento
+    Metrics metrics;                          // Contadores e página de métricas
+    volatile sig_atomic_t preemptDeferred;    // Seção com a preempção adiada
+    volatile sig_atomic_t preemptPending;     // Preempção ocorrida na seção
+    WaitBucket waitTable[WAIT_BUCKETS];       // Listas de espera da fiber_wait
+    Histogram * latency;                      // Histogramas de latência
+    uint64_t sliceStart;                      // Início da fatia atual
+    OffloadPool offload;                      // Threads auxiliares da fiber_offload
+    Admission admission;                      // Controle de admissão
+    void * spareStacks;                       // Reserva de pilhas livres
+    int nSpareStacks;                         // Pilhas na reserva
+    int lazyFibers;                           // Fibers sem pilha
+    ucontext_t exitContext;                   // Contexto de término da thread
+    volatile sig_atomic_t exiting;            // Thread terminando
+}FiberRuntime;
+
+// Runtime da thread atual(NULL até o primeiro uso): cada thread que cria fibers tem o seu próprio escalonador
+__thread FiberRuntime * runtime;
+
+// Chave cujo destrutor destrói o runtime quando a thread termina
+pthread_key_t runtimeKey;
+pthread_once_t runtimeKeyOnce = PTHREAD_ONCE_INIT;
+int runtimeKeyError;
+
+// Profiler por amostragem(desligado por padrão)
+Profiler profiler;
+
+// Tarefas enviadas por outras threads com a fiber_post
+PostQueue posted = { .eventFd = -1 };
+
+// Definidas junto com a fiber_create, mas também usadas pelo escalonador
+void pushFiber(Fiber * fiber);
+int admissionFull();
+int materializeFiber(Fiber * fiber, const FiberSpec * spec, int inSignal);
+void releaseStack(void * stack);
+void refillStacks();
+void freeStacks();
+void failFiber(Fiber * fiber, int err);
+
+// Definida junto com o escalonador, mas também usada pelo tratador do timer
+int schedule(int inSignal);
+
+// Definida junto com a fiber_join, mas também usada pelo ponto de entrada das fibers
+void fiber_exit(void *retval);
+
+// Definida junto com as demais rotinas de métricas, mas também usada pelo escalonador
+void fiber_metrics_stop();
+
+// Definida junto com a fiber_offload, mas também usada pelo escalonador
+void stopOffload();
+
+// Definidas junto com a fiber_wake, mas também usadas pelo controle de admissão
+int fiber_wait(int *addr, int expected);
+int wakeAddress(int * addr, int n);
+
+/*
+    monotonicNs
+    -----------
+
+    Retorna o CLOCK_MONOTONIC atual em nanossegundos.
+
+*/
+uint64_t monotonicNs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+    traceClock
+    ----------
+
+    Relógio usado nos timestamps do tracer: o contador de ciclos(rdtsc)
+    em processadores x86, ou o CLOCK_MONOTONIC nas demais arquiteturas.
+
+*/
+uint64_t traceClock(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return monotonicNs();
+#endif
+}
+
+/*
+    traceEvent
+    ----------
+
+    Registra um evento no buffer circular do tracer, caso ele esteja
+    ligado. Quando o buffer está cheio, o evento mais antigo é 
+    sobrescrito. Não faz alocações nem chamadas de sistema.
+
+    A posição é reservada antes de ser preenchida, com um único 
+    incremento atômico: uma preempção que registre um evento no meio 
+    da gravação(como na fiber_create(), com o timer ligado) recebe a 
+    posição seguinte, em vez de sobrescrever a mesma.
+
+*/
+void traceEvent(int type, fiber_t fiberId, int reason){
+    // Caso o tracer esteja desligado
+    if(runtime->tracer.events == NULL)
+        return;
+
+    // Reservando uma posição no buffer
+    uint64_t index = __atomic_fetch_add(&runtime->tracer.next, 1, __ATOMIC_RELAXED);
+
+    TraceEvent * event = &runtime->tracer.events[index & runtime->tracer.mask];
+    event->timestamp = traceClock();
+    event->fiberId = fiberId;
+    event->type = (uint16_t) type;
+    event->reason = (uint16_t) reason;
+}
+
+
+/*
+    latencyBucket
+    -------------
+
+    Retorna o bucket dos histogramas de latência da medida ns. Medidas
+    menores que LATENCY_SUB têm um bucket cada. As demais são divididas
+    pela potência de 2 abaixo delas(shift) e pelos LATENCY_SUB_BITS bits
+    seguintes ao mais significativo.
+
+*/
+int latencyBucket(uint64_t ns){
+    if(ns < LATENCY_SUB)
+        return (int) ns;
+
+    int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+    int bucket = (shift + 1) * LATENCY_SUB + (int) (ns >> shift) - LATENCY_SUB;
+
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+/*
+    recordLatency
+    -------------
+
+    Registra a medida ns no histograma de latência histogram do runtime.
+
+*/
+void recordLatency(int histogram, uint64_t ns){
+    Histogram * hist = &runtime->latency[histogram];
+
+    hist->counts[latencyBucket(ns)]++;
+    hist->total++;
+    if(ns > hist->max)
+        hist->max = ns;
+}
+
+/*
+    markReady
+    ---------
+
+    Torna pronta uma fiber que estava esperando algum evento, marcando
+    o instante para o histograma de espera. joined indica que ela foi
+    acordada pelo término da fiber que aguardava em um join.
+
+*/
+void markReady(Fiber * fiber, int joined){
+    fiber->status = READY;
+    fiber->readySince = runtime->latency != NULL ? monotonicNs() : 0;
+    fiber->joinWoken = joined;
+    traceEvent(TRACE_WAKE, fiber->fiberId, 0);
+}
+
+/*
+    switchOut e switchIn
+    --------------------
+
+    Registram a saída de uma fiber da CPU, com o motivo reason, e a 
+    entrada da próxima, no tracer e nos histogramas: a saída fecha a
+    fatia de execução, e caso a fiber continue pronta(preempção ou 
+    troca direta), marca o início da sua espera. A entrada fecha a 
+    espera da fiber, caso ela estivesse pronta esperando a CPU. Com as
+    medidas de latência desligadas, o relógio não é lido.
+
+*/
+void switchOut(Fiber * fiber, int reason){
+    if(runtime->latency != NULL){
+        uint64_t now = monotonicNs();
+
+        recordLatency(FIBER_LATENCY_SLICE, now - runtime->sliceStart);
+        if(fiber->status == READY){
+            fiber->readySince = now;
+            fiber->joinWoken = 0;
+        }
+    }
+
+    traceEvent(TRACE_SWITCH_OUT, fiber->fiberId, reason);
+}
+
+void switchIn(Fiber * fiber){
+    if(runtime->latency != NULL){
+        uint64_t now = monotonicNs();
+
+        if(fiber->readySince != 0){
+            recordLatency(FIBER_LATENCY_READY, now - fiber->readySince);
+            if(fiber->joinWoken)
+                recordLatency(FIBER_LATENCY_JOIN, now - fiber->readySince);
+            fiber->readySince = 0;
+            fiber->joinWoken = 0;
+        }
+        runtime->sliceStart = now;
+    }
+
+    traceEvent(TRACE_SWITCH_IN, fiber->fiberId, 0);
+}
+
+/*
+    timeHandler
+    -----------
+
+    Tratador do sinal SIGVTALRM, recebido sempre que o timer da thread é zerado.
+    Serve apenas para salvar o contexto da fiber atual e trocar o contexto para
+    a próxima fiber, escolhida pela schedule(). O timer de cada runtime envia o
+    sinal apenas para a sua thread, e caso a preempção esteja adiada, ela só 
+    ocorre na endDeferral().
+
+    Também é chamada diretamente(pela fiber_exit e pela endDeferral), com sig
+    igual a zero. Só nesse caso o escalonador pode alocar memória.
+
+
+*/
+void timeHandler(int sig){
+    // Threads sem fibers executando não têm o que escalonar
+    if(runtime == NULL || runtime->f_list == NULL || !runtime->f_list->started)
+        return;
+
+    // Em uma seção com a preempção adiada, a troca fica para o fim dela
+    if(runtime->preemptDeferred){
+        runtime->preemptPending = 1;
+        return;
+    }
+
+    // Também é chamada pela fiber_exit, com a fiber já terminada
+    if(runtime->f_list->currentFiber->status == READY)
+        runtime->metrics.preemptions++;
+
+    // Registrando a saída da fiber atual e o motivo dela
+    int reason = TRACE_PREEMPTED;
+    if(runtime->f_list->currentFiber->status == WAITING)
+        reason = TRACE_JOINED;
+    else if(runtime->f_list->currentFiber->status == FINISHED)
+        reason = TRACE_EXITED;
+    switchOut(runtime->f_list->currentFiber, reason);
+
+    if(schedule(sig != 0) == -1){
+    	perror("Ocorreu um erro no swapcontext da timeHandler");
+    	return;
+    }
+}
+
+/*
+    stopTimer
+    ------------
+
+    Salva os segundos e nanossegundos restantes do timer da thread
+    na estrutura apontada por restored, e para o timer. Caso restored
+    seja NULL, apenas para o timer. Antes do timer ser criado pela 
+    startFibers(), restored recebe um timer parado.
+
+*/
+void stopTimer(struct itimerspec * restored){
+    // O timer ainda não foi criado
+    if(runtime == NULL || runtime->f_list == NULL || !runtime->f_list->started){
+        if(restored != NULL)
+            memset(restored, 0, sizeof(struct itimerspec));
+        return;
+    }
+
+    // Se restored for NULL, não é pra restaurar. 
+    // Caso não seja, salva o tempo restante atual no ponteiro restored.
+    if(restored != NULL) 
+        if (timer_gettime(runtime->timerId, restored) == -1) {
+            perror("erro na timer_gettime() da stopTimer");
+            exit(1);
+        }
+    // Zerando segundos e nanossegundos
+    runtime->timer.it_value.tv_sec = 0;
+    runtime->timer.it_value.tv_nsec = 0;
+
+    // Parando o timer
+    if(timer_settime(runtime->timerId, 0, &runtime->timer, NULL) == -1){
+    	perror("Ocorreu um erro no timer_settime() da stopTimer");
+    	return;
+    }
+}
+
+/*
+    restoreTimer
+    ------------
+
+    Seta o timer com os valores obtidos pela estrutura apontada
+    por restored.
+
+*/
+void restoreTimer(struct itimerspec * restored){
+    // O timer ainda não foi criado
+    if(runtime == NULL || runtime->f_list == NULL || !runtime->f_list->started)
+        return;
+
+    // Restaurando o timer para o restante do timeslice
+    if(timer_settime(runtime->timerId, 0, restored, NULL) == -1){
+    	perror("Ocorreu um erro no timer_settime da restoreTimer");
+    	return;
+    }
+}
+
+/*
+    beginDeferral e endDeferral
+    ---------------------------
+
+    Delimitam uma seção crítica curta sem parar o timer: preempções que
+    ocorrerem dentro dela são adiadas até a endDeferral(). As barreiras
+    impedem que o compilador mova acessos para fora da seção.
+
+*/
+void beginDeferral(){
+    runtime->preemptDeferred = 1;
+    atomic_signal_fence(memory_order_seq_cst);
+}
+
+void endDeferral(){
+    atomic_signal_fence(memory_order_seq_cst);
+    runtime->preemptDeferred = 0;
+
+    // Realizando a preempção adiada
+    if(runtime->preemptPending){
+        runtime->preemptPending = 0;
+        timeHandler(0);
+    }
+}
+
+/*
+    allocFiber
+    ----------
+
+    Retira um cabeçalho de fiber da lista de cabeçalhos livres. Caso
+    ela esteja vazia, um novo bloco de FIBER_CHUNK cabeçalhos contíguos
+    é alocado e seus cabeçalhos são inseridos na lista de livres.
+    Também aloca a estrutura com os dados frios da fiber. Retorna NULL
+    caso alguma alocação falhe.
+
+*/
+Fiber * allocFiber(){
+
+    int i;
+    Fiber * fiber;
+
+    // Caso não haja cabeçalhos livres, aloca um novo bloco
+    if(runtime->f_list->freeFibers == NULL){
+        FiberChunk * chunk = (FiberChunk *) aligned_alloc(CACHE_LINE, sizeof(FiberChunk));
+        if(chunk == NULL){
+            perror("erro aligned_alloc na criação do bloco de fibers da allocFiber");
+            return NULL;
+        }
+        // Guardando o bloco para liberá-lo no fim do programa
+        chunk->next = runtime->f_list->chunks;
+        runtime->f_list->chunks = chunk;
+
+        // Encadeando os cabeçalhos do bloco na lista de livres, em ordem
+        for(i = FIBER_CHUNK - 1; i >= 0; i--){
+            chunk->fibers[i].next = runtime->f_list->freeFibers;
+            runtime->f_list->freeFibers = &chunk->fibers[i];
+        }
+    }
+
+    // Alocando os dados frios da fiber
+    FiberCold * cold = (FiberCold *) malloc(sizeof(FiberCold));
+    if(cold == NULL){
+        perror("erro malloc na criação dos dados da fiber na allocFiber");
+        return NULL;
+    }
+
+    // Retirando o primeiro cabeçalho livre
+    fiber = runtime->f_list->freeFibers;
+    runtime->f_list->freeFibers = fiber->next;
+
+    memset(fiber, 0, sizeof(Fiber));
+    memset(cold, 0, sizeof(FiberCold));
+    fiber->cold = cold;
+
+    return fiber;
+}
+
+/*
+    freeFiber
+    ---------
+
+    Libera os dados frios da fiber e devolve seu cabeçalho para a lista
+    de cabeçalhos livres. O bloco de uma fiber da fiber_post(), que 
+    contém os dois, é simplesmente liberado.
+
+*/
+void freeFiber(Fiber * fiber){
+    // O cabeçalho de uma tarefa da fiber_post é o início do bloco da tarefa
+    if(fiber->cold->posted){
+        free(fiber);
+        return;
+    }
+
+    free(fiber->cold);
+    fiber->cold = NULL;
+    fiber->next = runtime->f_list->freeFibers;
+    runtime->f_list->freeFibers = fiber;
+}
+
+/*
+    freeChunks
+    ----------
+
+    Libera todos os blocos de cabeçalhos de fibers alocados.
+
+*/
+void freeChunks(){
+    while(runtime->f_list->chunks != NULL){
+        FiberChunk * next = runtime->f_list->chunks->next;
+        free(runtime->f_list->chunks);
+        runtime->f_list->chunks = next;
+    }
+    runtime->f_list->freeFibers = NULL;
+}
+
+/*
+    allocArenaBlock
+    ---------------
+
+    Retorna um bloco de arena vazio com pelo menos size bytes, 
+    reaproveitando um bloco do pool de blocos livres quando possível.
+    Retorna NULL caso a alocação falhe.
+
+*/
+ArenaBlock * allocArenaBlock(size_t size){
+    ArenaBlock ** prev = &runtime->f_list->freeArenas;
+    ArenaBlock * block;
+
+    // Procurando um bloco livre grande o suficiente
+    for(block = runtime->f_list->freeArenas; block != NULL; prev = &block->next, block = block->next){
+        if(block->size >= size){
+            *prev = block->next;
+            runtime->f_list->nFreeArenas--;
+            block->next = NULL;
+            block->used = 0;
+            return block;
+        }
+    }
+
+    block = (ArenaBlock *) malloc(sizeof(ArenaBlock) + size);
+    if(block == NULL){
+        perror("erro malloc na criação do bloco da allocArenaBlock");
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+/*
+    releaseArena
+    ------------
+
+    Devolve todos os blocos da arena recebida para o pool de blocos
+    livres, liberando a memória dos que não couberem nele.
+
+*/
+void releaseArena(ArenaBlock * arena){
+    while(arena != NULL){
+        ArenaBlock * next = arena->next;
+        if(runtime->f_list->nFreeArenas < ARENA_POOL){
+            arena->next = runtime->f_list->freeArenas;
+            runtime->f_list->freeArenas = arena;
+            runtime->f_list->nFreeArenas++;
+        }
+        else 
+            free(arena);
+        arena = next;
+    }
+}
+
+/*
+    freeArenas
+    ----------
+
+    Libera todos os blocos do pool de blocos de arenas livres.
+
+*/
+void freeArenas(){
+    while(runtime->f_list->freeArenas != NULL){
+        ArenaBlock * next = runtime->f_list->freeArenas->next;
+        free(runtime->f_list->freeArenas);
+        runtime->f_list->freeArenas = next;
+    }
+    runtime->f_list->nFreeArenas = 0;
+}
+
+/*
+    findFiber
+    ---------
+
+    Função que retorna o endereço de memória que guarda a fiber que corresponde
+    ao id recebido "fiberId". Caso nenhuma fiber com esse id seja encontrada na
+    lista, a função retornará NULL.
+*/
+Fiber * findFiber(fiber_t fiberId){
+    
+    int i;
+    Fiber * fiber; 
+    
+    // Caso não haja lista de fibers ainda
+    if(runtime == NULL || runtime->f_list == NULL)
+        return NULL;
+
+    // Obtendo a primeira fiber da lista de fibers
+    fiber = (Fiber *) runtime->f_list->fibers;
+
+    // Se não estiver inicializado
+    if(fiberId == 0)
+        return NULL;
+
+    // Se for o id da thread principal, retorná-la
+    if(runtime->f_list->fibers->fiberId == fiberId)
+        return runtime->f_list->fibers;
+
+    // Se for o id da thread atual, retorná-la
+    if(runtime->f_list->currentFiber->fiberId == fiberId)
+        return runtime->f_list->currentFiber;
+
+    // Procurando a fiber com o id recebido
+    for(i = 0; i < runtime->f_list->nFibers; i++){ 
+        fiber = (Fiber *) fiber->next;
+        if(fiber->fiberId == fiberId)
+            break;
+    }
+
+    // Caso a fiber não tenha sido encontrada
+    if(i == runtime->f_list->nFibers) 
+        return NULL;
+    else return fiber; // Caso tenha sido encontrada, retorne a fiber
+}
+
+/*
+    releaseFibers
+    -------------
+
+    Função que libera todas as fibers da waitingList da fiber recebida num join para
+    que sejam executadas no escalonador, libera a memória alocada 
+    dos nodos da waitingList e também instancia o join_retval de 
+    cada uma das fibers corretamente. Como a fiber aguardada pode
+    ser destruída logo em seguida, o joinFiber das fibers liberadas
+    volta a ser NULL. Retorna a primeira fiber liberada(NULL caso
+    nenhuma tenha sido).
+*/
+Fiber * releaseFibers(Fiber * fiber){
+    Fiber * released = NULL;
+    Waiting * waitingList = fiber->cold->waitingList;
+    fiber->cold->waitingList = NULL;
+
+    // Enquanto houver fibers esperando
+    while(waitingList != NULL){
+        // Recebe o próximo nodo da lista
+        Waiting * waitingNode = waitingList->next; 
+        // Procura a fiber com o id do nodo atual da waitingList
+        Fiber * waitingFiber = findFiber(waitingList->waitingId); 
+        // Se a fiber existir e ainda estiver esperando esta fiber(ela pode ter sido 
+        // liberada pelo escalonador e estar esperando outra fiber agora)
+        if(waitingFiber != NULL && waitingFiber->status == WAITING && waitingFiber->joinFiber == fiber){
+            // Libera a fiber
+            markReady(waitingFiber, 1);
+            // Guarda o retval e o valor de retorno inline
+            waitingFiber->cold->join_retval = waitingFiber->joinFiber->cold->retval; 
+            memcpy(waitingFiber->cold->join_value, waitingFiber->joinFiber->cold->value, FIBER_INLINE_RETVAL);
+            waitingFiber->cold->join_error = fiber->cold->error;
+            // A fiber aguardada não deve mais ser acessada
+            waitingFiber->joinFiber = NULL;
+            // O retval foi recebido, e a fiber pode ser destruída
+            fiber->cold->retvalTaken = 1;
+            fiber->cold->joinable = 0;
+            if(released == NULL)
+                released = waitingFiber;
+        } 
+        // Libera o nodo no topo
+        free(waitingList); 
+        // Vai para o próximo nodo
+        waitingList = (Waiting *) waitingNode; 
+    }
+
+    return released;
+}
+
+/*
+    fiber_destroy
+    -------------
+
+    Libera a memória que foi alocada no endereço apontado por "fiber",
+    libera a memória que foi alocada para a pilha do contexto da fiber,
+    e reorganiza os nodos da lista de fibers.
+
+*/
+Fiber * fiber_destroy(Fiber * fiber){
+
+    // Erro, o ponteiro fiber aponta para NULL
+    if(fiber == NULL)
+        return NULL;
+
+    int id = fiber->fiberId;
 
     // Apenas fibers encerradas podem ser destruídas
     if(fiber->status != FINISHED)
 		return NULL; 
     
-    // Obtendo o endereço da fiber anterior à fiber que será destruída
-    Fiber * prevFiber = (Fiber *) fiber->prev;
+    // Obtendo o endereço da fiber anterior à fiber que será destruída
+    Fiber * prevFiber = (Fiber *) fiber->prev;
+
+    // Obtendo o endereço da fiber que sucede a fiber que será destruída
+    Fiber * nextFiber = (Fiber *) fiber->next;
+
+    // Caso os ponteiros next e prev da fiber não forem nulos
+	if(nextFiber != NULL && prevFiber != NULL){
+		// Removendo a fiber da lista circular
+		nextFiber->prev = (Fiber *) prevFiber; 
+		prevFiber->next = (Fiber *) nextFiber;
+	}    
+
+    // Se a fiber na cabeça da lista for destruída
+	if(id == runtime->f_list->fibers->fiberId)
+		runtime->f_list->fibers = nextFiber; // Instanciar corretamente a cabeça da lista como a próxima fiber
+    
+	
+    // Destruindo um retval que nenhuma fiber recebeu
+    if(fiber->cold->dispose != NULL && !fiber->cold->retvalTaken)
+        fiber->cold->dispose(fiber->cold->retval);
+
+    // Destruindo a fiber e devolvendo sua pilha, seu cabeçalho e sua arena para os pools
+    if(fiber->cold->routine != NULL){
+        if(fiber->cold->context != NULL)
+            releaseStack(fiber->cold->context->uc_stack.ss_sp);
+        else 
+            runtime->lazyFibers--;
+    }
+    releaseArena(fiber->cold->arena);
+    freeFiber(fiber);
+	fiber = NULL;
+
+    // Diminuindo o número de fibers da lista
+    runtime->f_list->nFibers--;
+
+    // Liberando a vaga para uma criação bloqueada no controle de admissão
+    if(runtime->admission.waiting > 0){
+        runtime->admission.released++;
+        wakeAddress(&runtime->admission.released, 1);
+    }
+
+	// Caso a lista tinha sido esvaziada, preencha os ponteiros com NULL para evitar acesso indevido 
+    // de memória
+	if(runtime->f_list->nFibers == 0){
+		nextFiber = NULL;
+		prevFiber = NULL;
+	}
+	
+    return nextFiber;
+}
+
+/*
+    initEventFd
+    -----------
+
+    Cria o eventFd pelo qual o escalonador é avisado de rotinas da
+    fiber_offload() concluídas, e o da fila da fiber_post() caso o
+    runtime da thread atual seja o dono dela, caso eles ainda não 
+    existam.
+
+*/
+int initEventFd(){
+    if(runtime->offload.eventFd == -1){
+        runtime->offload.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(runtime->offload.eventFd == -1){
+            perror("Ocorreu um erro no eventfd da initEventFd");
+            return ERR_IO;
+        }
+    }
+
+    if(posted.eventFd == -1 && atomic_load(&posted.owner) == runtime){
+        posted.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(posted.eventFd == -1){
+            perror("Ocorreu um erro no eventfd da initEventFd");
+            return ERR_IO;
+        }
+    }
+    return 0;
+}
+
+/*
+    waitEvents
+    ----------
+
+    Chamada pelo escalonador quando nenhuma fiber pode executar: espera
+    nos eventFds até que alguma rotina da fiber_offload() termine ou que
+    alguma tarefa seja enviada pela fiber_post(), caso o runtime da 
+    thread atual seja o dono da fila.
+
+    A flag sleeping é ligada antes da fila ser verificada uma última
+    vez, e a fiber_post() insere a tarefa antes de ler a flag. Assim,
+    ou o escalonador vê a tarefa e não dorme, ou o produtor vê a flag
+    e o acorda.
+
+*/
+void waitEvents(){
+    struct pollfd pfd[2];
+    uint64_t count;
+
+    if(initEventFd() != 0)
+        return;
+
+    pfd[0].fd = runtime->offload.eventFd;
+    pfd[0].events = POLLIN;
+
+    // Runtimes que não são donos da fila só esperam pela fiber_offload
+    if(atomic_load(&posted.owner) != runtime){
+        while(poll(pfd, 1, -1) == -1)
+            ;
+        return;
+    }
+
+    pfd[1].fd = posted.eventFd;
+    pfd[1].events = POLLIN;
+
+    atomic_store(&posted.sleeping, 1);
+    if(atomic_load(&posted.head) == NULL)
+        while(poll(pfd, 2, -1) == -1)
+            ;
+    atomic_store(&posted.sleeping, 0);
+
+    // Zerando o contador do eventfd da fila
+    if(read(posted.eventFd, &count, sizeof(count)) != sizeof(count))
+        return;
+}
+
+/*
+    drainPosted
+    -----------
+
+    Retira de uma só vez todas as tarefas enviadas pela fiber_post() e
+    insere as suas fibers na lista, na ordem de envio. O cabeçalho e os
+    dados frios já foram alocados pelo produtor, e a pilha é montada no
+    primeiro despacho, como nas demais fibers: nenhuma alocação é feita,
+    e por isso ela é chamada em todas as trocas, inclusive dentro do 
+    tratador do timer. Deve ser chamada com o timer parado. Tarefas que
+    excederem os limites do controle de admissão(o escalonador não pode
+    esperar uma vaga) ficam no backlog e são inseridas em uma próxima 
+    troca. Retorna a quantidade de fibers inseridas.
+
+*/
+int drainPosted(){
+    PostedTask * task, * next, * batch = NULL, * batchTail;
+    int created = 0;
+
+    // Só o runtime dono da fila executa as tarefas
+    if(atomic_load_explicit(&posted.owner, memory_order_relaxed) != runtime)
+        return 0;
+
+    // Retirando as tarefas e invertendo a pilha para a ordem de envio
+    task = atomic_exchange_explicit(&posted.head, NULL, memory_order_acquire);
+    batchTail = task;
+    while(task != NULL){
+        next = task->next;
+        task->next = batch;
+        batch = task;
+        task = next;
+    }
+
+    // Inserindo as tarefas no final do backlog
+    if(batch != NULL){
+        if(posted.backlog == NULL)
+            posted.backlog = batch;
+        else
+            posted.backlogTail->next = batch;
+        posted.backlogTail = batchTail;
+    }
+
+    // Inserindo as fibers, enquanto houver vagas
+    while(posted.backlog != NULL && !admissionFull()){
+        task = posted.backlog;
+        posted.backlog = task->next;
+
+        Fiber * fiberNode = &task->fiber;
+        fiberNode->status = READY;
+        fiberNode->readySince = runtime->latency != NULL ? monotonicNs() : 0;
+        runtime->lazyFibers++;
+        pushFiber(fiberNode);
+        traceEvent(TRACE_CREATE, fiberNode->fiberId, 0);
+        created++;
+    }
+    return created;
+}
+
+/*
+    collectOffloads
+    ---------------
+
+    Libera para execução as fibers cujas rotinas enviadas pela 
+    fiber_offload() já terminaram.
+
+*/
+void collectOffloads(){
+    uint64_t count;
+
+    // Zerando o contador do eventfd
+    if(read(runtime->offload.eventFd, &count, sizeof(count)) != sizeof(count))
+        return;
+
+    // Retirando a lista de jobs concluídos
+    pthread_mutex_lock(&runtime->offload.lock);
+    OffloadJob * job = runtime->offload.done;
+    runtime->offload.done = NULL;
+    pthread_mutex_unlock(&runtime->offload.lock);
+
+    // Liberando as fibers que estavam esperando
+    while(job != NULL){
+        OffloadJob * next = job->next;
+        markReady(job->fiber, 0);
+        runtime->offload.pending--;
+        job = next;
+    }
+}
+
+/*
+    publishMetrics
+    --------------
+
+    Copia os contadores do runtime para a página de métricas, sob o
+    seqlock. Caso force seja zero, só publica caso METRICS_INTERVAL 
+    já tenha passado desde a publicação anterior. Como só há um 
+    escritor, a publicação nunca espera por nada: os leitores é que
+    repetem a leitura caso ela coincida com uma escrita.
+
+*/
+void publishMetrics(int force){
+    FiberMetrics * page = runtime->metrics.page;
+    uint64_t ready = 0, joinWaiting = 0;
+    uint64_t now = monotonicNs();
+    int i;
+
+    if(!force && now - runtime->metrics.lastPublish < METRICS_INTERVAL)
+        return;
+
+    // Contando as fibers prontas e esperando joins(antes da primeira fiber, não há lista)
+    int nFibers = runtime->f_list != NULL ? runtime->f_list->nFibers : 0;
+    Fiber * fiber = nFibers > 0 ? runtime->f_list->fibers : NULL;
+    for(i = 0; i < nFibers; i++, fiber = fiber->next){
+        if(fiber->status == READY)
+            ready++;
+        else if(fiber->status == WAITING)
+            joinWaiting++;
+    }
+
+    uint64_t elapsed = now - runtime->metrics.lastPublish;
+    uint64_t perSec = elapsed > 0 ? (runtime->metrics.switches - runtime->metrics.lastSwitches) * 1000000000ull / elapsed : 0;
+
+    // Seq ímpar: escrita em andamento
+    __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    page->timestamp = now;
+    page->liveFibers = nFibers;
+    page->readyFibers = ready;
+    page->joinWaiting = joinWaiting;
+    page->switches = runtime->metrics.switches;
+    page->switchesPerSec = perSec;
+    page->preemptions = runtime->metrics.preemptions;
+    page->stackBytes = runtime->metrics.stackBytes;
+
+    // Seq par: página consistente
+    __atomic_store_n(&page->seq, page->seq + 1, __ATOMIC_RELEASE);
+
+    runtime->metrics.lastPublish = now;
+    runtime->metrics.lastSwitches = runtime->metrics.switches;
+}
+
+/*
+    releaseJoinable
+    ---------------
+
+    Caso todas as fibers da lista tenham terminado, as fibers joinable
+    deixam de ser mantidas na lista, já que nenhuma fiber poderá mais
+    aguardá-las, e são destruídas pelo escalonador. Generators suspensos
+    também são encerrados, já que nenhuma fiber poderá mais retomá-los.
+    Retorna 1 nesse caso, e 0 caso contrário.
+
+*/
+int releaseJoinable(){
+    int i;
+    Fiber * fiber = runtime->f_list->fibers;
+
+    for(i = 0; i < runtime->f_list->nFibers; i++, fiber = fiber->next)
+        if(fiber->status != FINISHED && fiber->status != SUSPENDED)
+            return 0;
+
+    for(i = 0; i < runtime->f_list->nFibers; i++, fiber = fiber->next){
+        if(fiber->status == SUSPENDED){
+            if(fiber->cold->generator != NULL)
+                fiber->cold->generator->done = 1;
+            fiber->status = FINISHED;
+        }
+        fiber->cold->joinable = 0;
+    }
+    return 1;
+}
+
+/*
+    destroyRuntime
+    --------------
+
+    Destrutor da chave do runtime, chamado quando uma thread que não é
+    a principal termina, seja pela fiber_exit() da sua última fiber ou
+    retornando normalmente. Remove o timer, termina as threads auxiliares
+    da fiber_offload(), publica as métricas finais, libera a fila da
+    fiber_post() para o próximo runtime iniciado e libera as fibers 
+    restantes, as pilhas, a pilha do escalonador e o próprio runtime.
+
+*/
+void destroyRuntime(void * arg){
+    FiberRuntime * self = (FiberRuntime *) arg;
+    sigset_t signals;
+    int i;
+
+    runtime = self;
+
+    // Nenhuma preempção ou amostra pode ocorrer durante a destruição
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGVTALRM);
+    sigaddset(&signals, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if(self->f_list != NULL && self->f_list->started)
+        timer_delete(self->timerId);
+
+    // As rotinas em execução terminam antes das pilhas dos seus jobs serem liberadas
+    stopOffload();
+
+    fiber_metrics_stop();
+
+    free(self->tracer.events);
+    self->tracer.events = NULL;
+    free(self->latency);
+    self->latency = NULL;
+
+    // Em caso de falha, a compare-and-swap sobrescreve owner com o dono atual
+    FiberRuntime * owner = self;
+    atomic_compare_exchange_strong(&posted.owner, &owner, NULL);
+
+    if(self->f_list != NULL){
+        Fiber * fiber = self->f_list->fibers;
+        for(i = 0; i < self->f_list->nFibers; i++){
+            Fiber * next = fiber->next;
+            FiberCold * cold = fiber->cold;
+
+            // Destruindo um retval que nenhuma fiber recebeu
+            if(fiber->status == FINISHED && cold->dispose != NULL && !cold->retvalTaken)
+                cold->dispose(cold->retval);
+
+            while(cold->waitingList != NULL){
+                Waiting * waitingNode = cold->waitingList->next;
+                free(cold->waitingList);
+                cold->waitingList = waitingNode;
+            }
+
+            // A pilha da thread não pertence à fiber, e a pilha em uso(caso a thread
+            // tenha terminado dentro de uma fiber) não pode ser liberada
+            if(cold->routine != NULL && cold->context != NULL && fiber != self->f_list->currentFiber)
+                free(cold->context->uc_stack.ss_sp);
+
+            releaseArena(cold->arena);
+            freeFiber(fiber);
+            fiber = next;
+        }
+
+        freeStacks();
+        freeChunks();
+        freeArenas();
+        free(self->f_list);
+        self->f_list = NULL;
+        free(self->schedulerContext.uc_stack.ss_sp);
+    }
+
+    pthread_mutex_destroy(&self->offload.lock);
+    pthread_cond_destroy(&self->offload.cond);
+    free(self);
+    runtime = NULL;
+}
+
+/*
+    getRuntime
+    ----------
+
+    Retorna o runtime da thread atual, alocando-o no primeiro uso. A
+    primeira alocação do processo também cria a chave cujo destrutor
+    destrói o runtime quando a thread termina. Retorna NULL caso a 
+    alocação falhe.
+
+*/
+void createRuntimeKey(){
+    runtimeKeyError = pthread_key_create(&runtimeKey, destroyRuntime);
+}
+
+FiberRuntime * getRuntime(){
+    if(runtime != NULL)
+        return runtime;
+
+    pthread_once(&runtimeKeyOnce, createRuntimeKey);
+    if(runtimeKeyError != 0){
+        errno = runtimeKeyError;
+        perror("Ocorreu um erro no pthread_key_create da getRuntime");
+        return NULL;
+    }
+
+    FiberRuntime * created = (FiberRuntime *) calloc(1, sizeof(FiberRuntime));
+    if(created == NULL){
+        perror("erro malloc na criação do runtime da getRuntime");
+        return NULL;
+    }
+    pthread_mutex_init(&created->offload.lock, NULL);
+    pthread_cond_init(&created->offload.cond, NULL);
+    created->offload.eventFd = -1;
+    pthread_setspecific(runtimeKey, created);
+
+    runtime = created;
+    return runtime;
+}
+
+/*
+    pickNext
+    --------
+
+    Escolhe a próxima fiber a ser executada, a partir da fiber logo após a atual.
+
+    Caso o status da próxima fiber não seja READY, o loop é executado e continuará
+    procurando fibers disponíveis para execução. Fibers com status WAITING poderão 
+    ser executadas, caso a fiber que elas estiverem esperando esteja terminada(status 
+    FINISHED), e terão seu status atualizado para READY novamente.  
+    
+    Fibers com status FINISHED nunca serão executadas, e, quando identificadas, terão 
+    suas waitingLists liberadas pela função releaseFibers(), que também instancia os 
+    ponteiros de valor de retorno adequadamente. Além disso, elas serão corretamente 
+    destruídas(terão sua memória liberada), e a lista de fibers será reconfigurada de 
+    acordo. Isso só é feito fora do tratador do sinal: durante uma preempção, a fiber
+    interrompida pode estar dentro da malloc()/free(), e o dispose de um retval é código
+    do usuário. Dentro dele, fibers terminadas, e as que aguardam uma delas, são apenas
+    puladas.
+
+    Fibers joinable(fiber_create_closure) terminadas são mantidas na lista até que alguma
+    fiber as aguarde ou que elas sejam desanexadas com fiber_detach().
+
+    Fibers com status OFFLOADED são puladas até que a rotina bloqueante que elas enviaram
+    para a fiber_offload() termine, e fibers com status SUSPENDED(generators e seus 
+    consumidores) só voltam a executar pela troca direta entre produtor e consumidor. 
+    Fibers com status PARKED são puladas até serem acordadas pela fiber_wake().
+
+    A pilha de uma fiber que ainda não executou é montada quando ela é escolhida. Dentro
+    do tratador do sinal, apenas pilhas da reserva do runtime podem ser usadas: sem elas,
+    a fiber fica para a próxima troca. Fora dele, caso a pilha não possa ser alocada, a 
+    fiber termina sem executar(ver failFiber). A reserva é reposta a cada troca fora do
+    tratador.
+
+    A cada chamada, inclusive dentro do tratador do sinal, as fibers das tarefas enviadas
+    por outras threads com a fiber_post() são inseridas na lista: elas foram alocadas pelo
+    produtor, e a inserção não aloca memória(ver drainPosted). Caso uma volta inteira seja
+    dada na lista sem que nenhuma fiber
+    possa ser executada, e ainda haja fibers não terminadas, o escalonador dorme no eventFd
+    até que alguma rotina da fiber_offload() termine ou alguma tarefa seja enviada.
+
+    running é a fiber em cuja pilha a escolha está sendo feita(NULL na pilha do escalonador),
+    que não pode ser destruída. Caso ela tenha terminado e precise ser destruída, NULL é 
+    retornado, e a escolha deve ser refeita na pilha do escalonador.
+
+    Quando a lista de fibers estiver completamente vazia, toda a memória alocada previamente
+    para estruturas da biblioteca será liberada, e o programa terminará. Caso alguma parte
+    desse processo falhe ou tenha comportamento inesperado, o programa terminará com retorno -1.
+
+
+*/
+Fiber * pickNext(Fiber * running, int inSignal) {
+    // Estrutura que armazenará a próxima fiber a ser executada
+    Fiber * nextFiber = (Fiber *) runtime->f_list->currentFiber->next;
+
+    // Como as preempções não destroem fibers, a fiber que terminou é destruída na hora,
+    // na pilha do escalonador, em vez de esperar que outra troca passe por ela
+    if(running != NULL && running->status == FINISHED && !running->cold->joinable)
+        return NULL;
+    if(running == NULL && runtime->f_list->currentFiber->status == FINISHED)
+        nextFiber = runtime->f_list->currentFiber;
+
+    // Quantidade de fibers puladas seguidamente
+    int skipped = 0;
+
+    // Liberando as fibers cujas rotinas da fiber_offload já terminaram
+    if(runtime->offload.pending > 0)
+        collectOffloads();
+
+    // Inserindo as fibers das tarefas enviadas pela fiber_post
+    if(posted.backlog != NULL || atomic_load_explicit(&posted.head, memory_order_relaxed) != NULL)
+        drainPosted();
+
+    // Repondo as pilhas da reserva usadas por preempções
+    if(!inSignal)
+        refillStacks();
+
+    // Publicando as métricas(no máximo uma vez a cada METRICS_INTERVAL)
+    if(runtime->metrics.page != NULL)
+        publishMetrics(0);
+    
+    // Enquanto não encontrar uma fiber pronta para ser executada, com a pilha montada
+    while(nextFiber->status != READY || materializeFiber(nextFiber, NULL, inSignal) != 0) { 
+        // Caso a fiber esteja pronta, mas sua pilha não possa ser montada agora
+        if(nextFiber->status == READY){
+            // Dentro do tratador, sem pilhas na reserva: a fiber fica para a próxima troca
+            if(inSignal){
+                nextFiber = (Fiber *) nextFiber->next;
+                skipped++;
+                continue;
+            }
+            // Sem memória para a pilha: a fiber termina sem executar
+            failFiber(nextFiber, ERR_MALL);
+        }
+        // Caso nenhuma fiber possa executar depois de uma volta inteira na lista
+        if(skipped >= runtime->f_list->nFibers){
+            // Caso só restem fibers terminadas, ninguém mais poderá aguardá-las.
+            // Caso contrário, espera uma rotina da fiber_offload ou uma tarefa da fiber_post
+            if(drainPosted() == 0 && !inSignal && !releaseJoinable()){
+                // As métricas ficam atualizadas enquanto o escalonador dorme
+                if(runtime->metrics.page != NULL)
+                    publishMetrics(1);
+                waitEvents();
+                collectOffloads();
+                drainPosted();
+            }
+            skipped = 0;
+        }
+        // Caso a fiber já tenha terminado
+        if(nextFiber->status == FINISHED){
+            // Dentro do tratador, a fiber apenas é pulada: o dispose do retval e a 
+            // liberação da memória ficam para a próxima troca fora dele
+            if(inSignal){
+                nextFiber = (Fiber *) nextFiber->next;
+                skipped++;
+                continue;
+            }
+            // Liberando as fibers esperando esta(caso existam)
+            releaseFibers(nextFiber);
+            // Fibers joinable são mantidas até que alguma fiber as aguarde
+            if(nextFiber->cold->joinable){
+                nextFiber = (Fiber *) nextFiber->next;
+                skipped++;
+                continue;
+            }
+            // A fiber cuja pilha está em uso só pode ser destruída na pilha do escalonador
+            if(nextFiber == running)
+                return NULL;
+            // Destruindo essa fiber e obtendo a próxima(caso exista)
+            nextFiber = fiber_destroy(nextFiber);
+            // Se a fiber_destroy retornar NULL
+            if(nextFiber == NULL){
+				// Caso não haja mais nenhuma fiber na lista
+                if(runtime->f_list->nFibers == 0){
+                    // Nas demais threads, a thread volta para a fiber_exit() da sua própria fiber e
+                    // termina na sua pilha original, e o destrutor do runtime libera todo o resto
+                    if(gettid() != getpid()){
+                        runtime->exiting = 1;
+                        sigaddset(&runtime->exitContext.uc_sigmask, SIGVTALRM);
+                        setcontext(&runtime->exitContext);
+                    }
+                    fiber_metrics_stop(); // Publicando as métricas finais e removendo a página
+                    freeStacks(); // Liberando a reserva de pilhas
+                    freeChunks(); // Liberando os blocos de cabeçalhos
+                    freeArenas(); // Liberando os blocos de arenas
+                    free(runtime->f_list); // Liberando a lista de fibers
+                    // A pilha do escalonador não é liberada: a própria exit() executa sobre ela
+                    exit(0); // Terminando o programa
+                }
+				// Caso contrário, algum erro ocorreu
+				exit(-1); 
+            }
+        } 
+        // Caso a thread atual esteja num join
+        if(nextFiber->status == WAITING) { 
+            // Caso a thread que ela está esperando não estiver encerrada(dentro do tratador,
+            // ela ainda não foi liberada pela releaseFibers(), que entrega o retval)
+            if(nextFiber->joinFiber != NULL && (inSignal || nextFiber->joinFiber->status != FINISHED)){
+                nextFiber = (Fiber *) nextFiber->next; // Pula a thread que está esperando
+                skipped++;
+            }
+            // Caso a thread que ela está esperando tenha terminado
+            else {
+                markReady(nextFiber, 1); // Definir o status como READY
+            }
+            
+        }
+        // Caso a fiber esteja esperando uma rotina da fiber_offload, suspensa em um generator
+        // ou parada na fiber_wait
+        else if(nextFiber->status == OFFLOADED || nextFiber->status == SUSPENDED || nextFiber->status == PARKED){
+            nextFiber = (Fiber *) nextFiber->next; // Pula a fiber
+            skipped++;
+        }
+    } 
+
+    return nextFiber;
+}
+
+/*
+    enterFiber
+    ----------
+
+    Define a fiber recebida como a fiber atual, reinicia o timer com um
+    timeslice completo e registra a entrada dela no tracer. O contexto
+    deve ser trocado para o dela logo em seguida.
+
+*/
+void enterFiber(Fiber * fiber){
+    // Definindo a próxima fiber selecionada como a fiber atual
+	runtime->f_list->currentFiber = fiber;
+
+    // Uma preempção adiada da fiber anterior não vale para o novo timeslice
+    runtime->preemptPending = 0;
+
+    runtime->metrics.switches++;
+
+    // Redefinindo o timer para o tempo normal
+    runtime->timer.it_value.tv_sec = SECONDS;
+    runtime->timer.it_value.tv_nsec = MICSECONDS * 1000;
+
+    // Resetando o timer
+    restoreTimer(&runtime->timer);
+
+    // Registrando a entrada da próxima fiber
+    switchIn(fiber);
+}
+
+/*
+    switchFiber
+    -----------
+
+    Troca diretamente da fiber current, em cuja pilha a chamada é feita,
+    para a fiber next, sem passar pelo contexto do escalonador. Caso 
+    current tenha terminado, seu contexto não é salvo, já que ela nunca
+    mais executará. Caso next seja a própria current, apenas reinicia o
+    timer. O timer deve estar parado, ou a preempção adiada.
+
+    Toda fiber retomada termina a seção com a preempção adiada na qual
+    a fiber anterior trocou para ela(ver endDeferral).
+
+*/
+int switchFiber(Fiber * current, Fiber * next){
+    enterFiber(next);
+
+    if(next != current){
+        if(current->status == FINISHED)
+            return setcontext(next->cold->context);
+        if(swapcontext(current->cold->context, next->cold->context) == -1)
+            return -1;
+    }
+
+    endDeferral();
+    return 0;
+}
+
+/*
+    yieldTo
+    -------
+
+    Troca diretamente da fiber current para a fiber next sem reiniciar
+    o timer: next continua o timeslice de current. Usada na troca entre
+    o produtor e o consumidor de um generator e na fiber_wait(), dentro
+    de uma seção com a preempção adiada, que é terminada quando current
+    é retomada. reason é o motivo registrado no tracer.
+
+*/
+int yieldTo(Fiber * current, Fiber * next, int reason){
+    runtime->f_list->currentFiber = next;
+    runtime->metrics.switches++;
+
+    switchOut(current, reason);
+    switchIn(next);
+
+    if(swapcontext(current->cold->context, next->cold->context) == -1)
+        return -1;
+
+    endDeferral();
+    return 0;
+}
+
+/*
+    schedule
+    --------
+
+    Chamada na pilha da fiber atual sempre que ela deixa de executar(por 
+    preempção, join, fiber_offload ou fiber_exit): escolhe a próxima fiber
+    com a pickNext() ali mesmo e troca diretamente para ela, com uma 
+    única troca de contexto. Só quando a fiber atual terminou e precisa
+    ser destruída a escolha é deixada para o contexto do escalonador, 
+    que executa em uma pilha própria. inSignal indica que a chamada
+    vem do tratador do SIGVTALRM(ver pickNext).
+
+*/
+int schedule(int inSignal){
+    Fiber * current = runtime->f_list->currentFiber;
+
+    // Zerando o timer para pará-lo
+    stopTimer(NULL);
+
+    Fiber * next = pickNext(current, inSignal);
+    if(next != NULL)
+        return switchFiber(current, next);
+
+    // A fiber atual terminou: o escalonador a destrói e escolhe a próxima
+    if(current->status == FINISHED)
+        return setcontext(&runtime->schedulerContext);
+    if(swapcontext(current->cold->context, &runtime->schedulerContext) == -1)
+        return -1;
+
+    endDeferral();
+    return 0;
+}
+
+/*
+    fiberScheduler
+    --------------
+
+    Contexto do escalonador, com pilha própria. É usado quando a fiber 
+    atual terminou e precisa ser destruída(pela schedule()): escolhe a 
+    próxima fiber com a pickNext() e troca o contexto para o dela. Como
+    as fibers só terminam pela fiber_exit(), nunca executa dentro do 
+    tratador do sinal.
+
+*/
+void fiberScheduler() {
+    // Zerando o timer para pará-lo
+    stopTimer(NULL);
+
+    Fiber * nextFiber = pickNext(NULL, 0);
+    enterFiber(nextFiber);
+
+    // Definindo o contexto atual como o da próxima fiber
+	if(setcontext(nextFiber->cold->context) == -1){
+    	perror("Ocorreu um erro no setcontext da fiberScheduler");
+    	return;
+    }
+}
+
+/*  
+    startFibers
+    -----------
+
+    Função responsável por inicializar as estruturas do timer e 
+    sinalizador, e a cada SECONDS segundos e MICSECONDS microssegundos
+    de CPU consumidos pela thread atual, um sinal é enviado apenas para
+    ela, cujo tratador é o a rotina timeHandler(), que chama o 
+    escalonador de fibers do seu runtime.
+
+*/
+void startFibers() {
+    // Criando e inicializando a struct do sigaction
+    struct sigaction sa;
+    memset (&sa, 0, sizeof (sa));
+
+    // Evento do timer: o SIGVTALRM é entregue apenas para a thread atual
+    struct sigevent sev;
+    memset (&sev, 0, sizeof (sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGVTALRM;
+    sev.sigev_notify_thread_id = gettid();
+
+    // Atribuindo a rotina timeHandler() como tratador do sinal
+    sa.sa_handler = &timeHandler;
+
+    // Chamada de sistema para configurar o tratador do sinal SIGVTALRM no processo
+    if(sigaction (SIGVTALRM, &sa, NULL) == -1){
+    	perror("Ocorreu um erro no sigaction da startFibers");
+    	return;
+    }
+    
+    // Criando o timer do tempo de CPU da thread
+    if(timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &runtime->timerId) == -1){
+    	perror("Ocorreu um erro no timer_create da startFibers");
+    	return;
+    }
+
+    // Inicializando o timer e seus intervalos
+    runtime->timer.it_value.tv_sec = SECONDS;
+    runtime->timer.it_value.tv_nsec = MICSECONDS * 1000;
+ 
+    runtime->timer.it_interval.tv_sec = SECONDS;
+    runtime->timer.it_interval.tv_nsec = MICSECONDS * 1000;
+
+    // A thread atual começa a primeira fatia de execução
+    if(runtime->latency != NULL)
+        runtime->sliceStart = monotonicNs();
+
+    // Começando o timer
+    restoreTimer(&runtime->timer);
+}
+
+/*
+    initFiberList
+    -------------
+
+    Função responsável por inicializar a lista de fibers caso ela não tenha
+    sido inicializada ainda.
+
+    Ela também insere a estrutura da thread principal como a cabeça da lista,
+    e cria o contexto para a função FiberScheduler.
+*/
+int initFiberList() {
+    
+    // Criando a estrutura da lista
+    runtime->f_list = (FiberList *) malloc(sizeof(FiberList));
+    if (runtime->f_list == NULL) {
+        perror("erro malloc na criação da lista na initFiberList");
+        return ERR_MALL;
+    }
+    // Inicializando a lista de fibers
+    runtime->f_list->fibers = NULL;
+    runtime->f_list->nFibers = 0;
+    runtime->f_list->currentFiber = NULL;
+    runtime->f_list->started = 0;
+    runtime->f_list->nextId = 1;
+    runtime->f_list->chunks = NULL;
+    runtime->f_list->freeFibers = NULL;
+    runtime->f_list->freeArenas = NULL;
+    runtime->f_list->nFreeArenas = 0;
+    
+    // Criando a estrutura de fiber para a thread principal
+    Fiber * parentFiber = allocFiber();
+    if (parentFiber == NULL) {
+        perror("erro malloc na criação da parentFiber da initFiberList");
+        return ERR_MALL;
+    }
+
+    // Inicializando a estrutura da thread principal
+    parentFiber->cold->context = &runtime->parentContext;
+    parentFiber->cold->routine = NULL;
+    parentFiber->cold->arena = NULL;
+    parentFiber->cold->arenaSize = 0;
+    memset(parentFiber->cold->value, 0, FIBER_INLINE_RETVAL);
+    parentFiber->fiberId = PARENT_ID;
+    parentFiber->prev = NULL;
+    parentFiber->next = NULL; 
+    parentFiber->status = READY;
+    parentFiber->readySince = 0;
+    parentFiber->joinWoken = 0;
+
+    // Adicionado a estrutura da thread principal como o primeiro elemento da lista
+    runtime->f_list->fibers = (Fiber *) parentFiber;
+
+    // Incrementando o número de fibers da lista
+    runtime->f_list->nFibers++;
+
+    // Definindo a thread principal como fiber atual
+    runtime->f_list->currentFiber = (Fiber *) parentFiber;
+
+    // Obtendo um contexto para o escalonador
+    if(getcontext(&runtime->schedulerContext) == -1){
+    	perror("Ocorreu um erro no getcontext da initFiberList");
+    	return ERR_GTCTX;
+    }
+    
+    // Limpando o contexto recebido para o escalonador
+    runtime->schedulerContext.uc_link = &runtime->parentContext;
+    runtime->schedulerContext.uc_stack.ss_sp = malloc(FIBER_STACK);
+    runtime->schedulerContext.uc_stack.ss_size = FIBER_STACK;
+    runtime->schedulerContext.uc_stack.ss_flags = 0;        
+    if (runtime->schedulerContext.uc_stack.ss_sp == NULL) {
+        perror("erro malloc na criação da pilha na initFiberList");
+        return ERR_MALL;
+    }
+    runtime->metrics.stackBytes += FIBER_STACK;
+
+    // Criando o contexto do escalonador 
+    makecontext(&runtime->schedulerContext, fiberScheduler, 1, NULL);
+
+    // Capturando o contexto modelo das fibers(a única getcontext() delas)
+    if(getcontext(&runtime->fiberTemplate) == -1){
+    	perror("Ocorreu um erro no getcontext da initFiberList");
+    	return ERR_GTCTX;
+    }
+
+    // A lista pode ser criada com os sinais da biblioteca bloqueados: as fibers
+    // não devem herdar essa máscara
+    sigdelset(&runtime->fiberTemplate.uc_sigmask, SIGVTALRM);
+    sigdelset(&runtime->fiberTemplate.uc_sigmask, SIGPROF);
+    runtime->fiberTemplate.uc_link = &runtime->schedulerContext;
+
+    // Garantindo uma pilha para que uma preempção possa despachar a primeira fiber
+    refillStacks();
+
+	return 0;
+}
+
+/*
+    pushFiber
+    ---------
+
+    Insere a fiber recebida pela função na lista de fibers. Caso a 
+    lista ainda não tenha sido criada, a função initFiberList() é 
+    chamada. Durante a inserção da fiber, o timeslice restante da 
+    fiber atual é salvo e o timer é pausado. Depois que a inserção
+    é feita, o timer é reiniciado com o timeslice salvo anteriormente.
+
+*/
+void pushFiber(Fiber * fiber) {
+    
+    struct itimerspec restored;
+
+    // Iniciando a lista de fibers, caso seja null
+    if(runtime->f_list == NULL)
+        initFiberList();
+
+    // Para o timer para evitar troca de fibers em região crítica
+    stopTimer(&restored);
+    // Caso só haja a fiber da thread principal na lista
+    if (runtime->f_list->nFibers == 1) {
+        fiber->prev = (Fiber *) runtime->f_list->fibers;
+        fiber->next = runtime->f_list->fibers;
+        runtime->f_list->fibers->prev = (Fiber *) fiber; 
+        runtime->f_list->fibers->next = (Fiber *) fiber;
+        
+    } 
+    else { // Caso haja outras fibers na lista
+        fiber->next = (Fiber *) runtime->f_list->fibers;
+        fiber->prev = (Fiber *) runtime->f_list->fibers->prev;
+        fiber->prev->next = (Fiber *) fiber;
+        runtime->f_list->fibers->prev = (Fiber *) fiber;
+    }
+
+	// Incrementando o número de fibers
+    runtime->f_list->nFibers++;
+
+    // Definindo o id da fiber
+    fiber->fiberId = runtime->f_list->nextId++;
+	
+    // restaura o timer para o restante do timeslice que a fiber atual possuía
+    restoreTimer(&restored);
+    
+}
+
+/*
+    fiberMain
+    ---------
+
+    Ponto de entrada de todas as fibers criadas: termina a seção com a
+    preempção adiada na qual a fiber anterior trocou para esta, chama
+    a rotina da fiber com seu argumento e, caso ela retorne, termina a
+    fiber com o valor retornado, como a fiber_exit().
+
+*/
+void fiberMain(){
+    endDeferral();
+
+    FiberCold * cold = runtime->f_list->currentFiber->cold;
+    fiber_exit(cold->routine(cold->arg));
+}
+
+/*
+    stackTarget
+    -----------
+
+    Quantidade de pilhas que a reserva deve ter: uma a mais que as 
+    fibers sem pilha, até STACK_RESERVE. A pilha extra permite que uma
+    preempção despache uma fiber criada depois da última troca fora do
+    tratador do timer, já que a criação não repõe a reserva.
+
+*/
+int stackTarget(){
+    return runtime->lazyFibers < STACK_RESERVE ? runtime->lazyFibers + 1 : STACK_RESERVE;
+}
+
+/*
+    takeStack
+    ---------
+
+    Retira uma pilha da reserva do runtime. Fora do tratador do timer
+    (inSignal igual a zero), a reserva só é usada quando tem mais pilhas
+    que as que as preempções podem precisar(ver stackTarget), e uma nova
+    pilha é alocada caso contrário. Retorna NULL caso nenhuma pilha seja
+    obtida.
+
+*/
+void * takeStack(int inSignal){
+    void * stack = runtime->spareStacks;
+
+    if(stack != NULL && (inSignal || runtime->nSpareStacks > stackTarget())){
+        runtime->spareStacks = *(void **) stack;
+        runtime->nSpareStacks--;
+        return stack;
+    }
+    if(inSignal)
+        return NULL;
+
+    stack = malloc(FIBER_STACK);
+    if(stack != NULL)
+        runtime->metrics.stackBytes += FIBER_STACK;
+    return stack;
+}
+
+/*
+    releaseStack
+    ------------
+
+    Devolve a pilha de uma fiber destruída para a reserva, caso ela 
+    ainda não esteja completa(ver stackTarget), ou a libera.
+
+*/
+void releaseStack(void * stack){
+    if(runtime->nSpareStacks < stackTarget()){
+        *(void **) stack = runtime->spareStacks;
+        runtime->spareStacks = stack;
+        runtime->nSpareStacks++;
+        return;
+    }
+
+    runtime->metrics.stackBytes -= FIBER_STACK;
+    free(stack);
+}
+
+/*
+    refillStacks
+    ------------
+
+    Completa a reserva de pilhas(ver stackTarget). Aloca memória, e por
+    isso só é chamada fora do tratador do timer: na criação do runtime e
+    nas trocas de contexto fora dele, nunca na criação de uma fiber.
+
+*/
+void refillStacks(){
+    while(runtime->nSpareStacks < stackTarget()){
+        void * stack = malloc(FIBER_STACK);
+        if(stack == NULL)
+            return;
+        runtime->metrics.stackBytes += FIBER_STACK;
+        *(void **) stack = runtime->spareStacks;
+        runtime->spareStacks = stack;
+        runtime->nSpareStacks++;
+    }
+}
+
+/*
+    freeStacks
+    ----------
+
+    Libera todas as pilhas da reserva.
+
+*/
+void freeStacks(){
+    while(runtime->spareStacks != NULL){
+        void * next = *(void **) runtime->spareStacks;
+        free(runtime->spareStacks);
+        runtime->metrics.stackBytes -= FIBER_STACK;
+        runtime->spareStacks = next;
+    }
+    runtime->nSpareStacks = 0;
+}
+
+/*
+    materializeFiber
+    ----------------
+
+    Monta a pilha de uma fiber que ainda não executou, caso isso ainda
+    não tenha sido feito. O contexto da fiber é uma cópia do contexto 
+    modelo do runtime, guardada no topo da pilha, que a makecontext() 
+    redireciona para a fiberMain(): nenhuma chamada de sistema é feita.
+    Dentro do tratador do timer(inSignal diferente de zero), só pilhas
+    da reserva são usadas, e ERR_NOTREADY é retornado caso ela esteja 
+    vazia. Caso spec não seja NULL e spec->storageSize seja diferente
+    de zero, também reserva a área logo abaixo do contexto, a inicializa
+    com spec->init e a passa como argumento da rotina.
+
+*/
+int materializeFiber(Fiber * fiber, const FiberSpec * spec, int inSignal){
+    // Fibers já materializadas e a thread principal
+    if(fiber->cold->context != NULL || fiber->cold->routine == NULL)
+        return 0;
+
+    // A fiber deixa de contar entre as que a reserva deve atender
+    runtime->lazyFibers--;
+    void * stack = takeStack(inSignal);
+
+    // Caso nenhuma pilha possa ser obtida
+    if(stack == NULL){
+        runtime->lazyFibers++;
+        if(inSignal)
+            return ERR_NOTREADY;
+        perror("erro malloc na criação da pilha na materializeFiber");
+        return ERR_MALL;
+    }
+
+    // Copiando o contexto modelo para o topo da pilha. O ponteiro para o estado de
+    // ponto flutuante da cópia continua apontando para o do modelo, que é válido, 
+    // até que a fiber seja salva pela primeira vez
+    uintptr_t top = ((uintptr_t) stack + FIBER_STACK - sizeof(ucontext_t)) & ~(uintptr_t) (CLOSURE_ALIGN - 1);
+    ucontext_t * fiberContext = (ucontext_t *) top;
+    memcpy(fiberContext, &runtime->fiberTemplate, sizeof(ucontext_t));
+
+    // Modificando o contexto para a nova pilha, abaixo do próprio contexto
+    fiberContext->uc_stack.ss_sp = stack;
+    fiberContext->uc_stack.ss_size = top - (uintptr_t) stack;
+    fiberContext->uc_stack.ss_flags = 0;
+
+    // Reservando a área abaixo do contexto e a inicializando
+    if(spec != NULL && spec->storageSize != 0){
+        fiber->cold->arg = (void *) ((top - spec->storageSize) & ~(uintptr_t) (CLOSURE_ALIGN - 1));
+        fiberContext->uc_stack.ss_size = (uintptr_t) fiber->cold->arg - (uintptr_t) stack;
+        spec->init(fiber->cold->arg, spec->ctx);
+    }
+
+    // Criando a fiber propriamente dita
+    makecontext(fiberContext, fiberMain, 0);
+    fiber->cold->context = fiberContext;
+
+    return 0;
+}
+
+/*
+    failFiber
+    ---------
+
+    Termina, sem que ela tenha executado, uma fiber cuja pilha não pôde
+    ser alocada. As fibers que derem join nela recebem o erro err, ao 
+    invés do processo inteiro terminar.
+
+*/
+void failFiber(Fiber * fiber, int err){
+    fiber->status = FINISHED;
+    fiber->cold->error = err;
+    fiber->cold->retval = NULL;
+    traceEvent(TRACE_EXIT, fiber->fiberId, 0);
+}
+
+/*
+    admissionFull
+    -------------
+
+    Retorna diferente de zero caso os limites configurados pela 
+    fiber_set_limits() não permitam mais nenhuma fiber no runtime 
+    atual, contando as fibers vivas e as vagas já reservadas. Não faz
+    chamadas de sistema.
+
+*/
+int admissionFull(){
+    Admission * admission = &runtime->admission;
+
+    // Fibers vivas, sem contar a própria thread(antes da primeira fiber, não há lista)
+    int live = (runtime->f_list != NULL ? runtime->f_list->nFibers - 1 : 0) + admission->admitted;
+
+    return (admission->maxFibers > 0 && live >= admission->maxFibers) ||
+           (admission->maxStackBytes > 0 && (size_t) (live + 1) * FIBER_STACK > admission->maxStackBytes);
+}
+
+/*
+    admitFiber
+    ----------
+
+    Reserva uma vaga para uma nova fiber no controle de admissão do
+    runtime atual. Enquanto os limites configurados pela 
+    fiber_set_limits() estiverem atingidos, retorna ERR_BUSY caso 
+    nonBlocking seja diferente de zero, ou para a fiber atual até que
+    alguma fiber seja destruída. A vaga é contada em admitted até que
+    a fiber seja inserida na lista, ou devolvida com a leaveAdmission().
+
+*/
+int admitFiber(int nonBlocking){
+    Admission * admission = &runtime->admission;
+    struct itimerspec restored;
+
+    // O timer é parado ao invés de adiar a preempção, já que a criação 
+    // também ocorre dentro da fiber_wait
+    for(;;){
+        stopTimer(&restored);
+
+        if(!admissionFull()){
+            admission->admitted++;
+            restoreTimer(&restored);
+            return 0;
+        }
+        if(nonBlocking){
+            restoreTimer(&restored);
+            return ERR_BUSY;
+        }
+
+        // Esperando uma vaga. Caso alguma seja liberada antes da parada, a fiber_wait retorna na hora
+        int epoch = admission->released;
+        admission->waiting++;
+        restoreTimer(&restored);
+
+        fiber_wait(&admission->released, epoch);
+
+        stopTimer(&restored);
+        admission->waiting--;
+        restoreTimer(&restored);
+    }
+}
+
+/*
+    leaveAdmission
+    --------------
+
+    Devolve a vaga reservada pela admitFiber(), depois que a fiber é 
+    inserida na lista(e passa a ser contada pelo nFibers) ou quando a
+    criação falha.
+
+*/
+void leaveAdmission(){
+    struct itimerspec restored;
+
+    stopTimer(&restored);
+    runtime->admission.admitted--;
+    restoreTimer(&restored);
+}
+
+/*
+    createFiber
+    -----------
+
+    Implementação das variações da fiber_create(), com as opções de
+    criação recebidas em spec(NULL para as opções padrão). Caso 
+    spec->arenaSize seja diferente de zero, o primeiro bloco da arena 
+    da fiber é alocado junto com ela.
+
+    A criação apenas registra a rotina e o argumento da fiber, sem 
+    chamadas de sistema: a pilha e o contexto só são montados pela 
+    materializeFiber() quando ela é escolhida para executar pela 
+    primeira vez. A exceção são as 
+    fibers com uma área reservada na pilha(spec->storageSize), que 
+    precisa ser preenchida durante a criação.
+
+    Caso o runtime tenha limites de admissão, a criação espera uma vaga
+    ou, com spec->nonBlocking, retorna ERR_BUSY(ver admitFiber), a não
+    ser que spec->admitted indique que ela já foi reservada.
+
+*/
+int createFiber(fiber_t *fiber, void *(*start_routine) (void *), void *arg, const FiberSpec * spec) {
+    // Opções padrão
+    FiberSpec defaults = { .nonBlocking = 0 };
+    if(spec == NULL)
+        spec = &defaults;
+
+    int err;
+
+    // Struct que irá armazenar a nova fiber
+    Fiber * fiberNode;
+
+    // Vaga reservada pelo chamador, que é devolvida em qualquer caso
+    int admitted = spec->admitted;
+
+    // Se o ponteiro apontar para NULL
+    if(fiber == NULL){
+        if(admitted)
+            leaveAdmission();
+        return ERR_NULLID;
+    }
+
+    // Obtendo o runtime da thread atual, caso esta seja a sua primeira fiber
+    if(getRuntime() == NULL)
+        return ERR_MALL;
+    
+    // Verificando se já existe uma fiber com esse id
+    if(findFiber(* fiber) != NULL){
+        printf("Essa fiber já existe\n");
+        if(admitted)
+            leaveAdmission();
+        return ERR_EXISTS;
+    }    
+
+    // Iniciando a lista de fibers, caso seja null
+    if(runtime->f_list == NULL && initFiberList() != 0){
+        if(admitted)
+            leaveAdmission();
+        return ERR_MALL;
+    }
+
+    // Reservando uma vaga, caso o runtime tenha limites de admissão e o chamador não a tenha reservado
+    if(!admitted && (runtime->admission.maxFibers > 0 || runtime->admission.maxStackBytes > 0)){
+        if((err = admitFiber(spec->nonBlocking)) != 0)
+            return err;
+        admitted = 1;
+    }
+
+    // Obtendo um cabeçalho de fiber do pool
+    fiberNode = allocFiber();
+
+    // Caso a alocação de memória falhe
+    if (fiberNode == NULL) {
+        perror("erro malloc na criação da fiber struct da fiber_create");
+        if(admitted)
+            leaveAdmission();
+        return ERR_MALL;
+    }
+
+    // Alocando o primeiro bloco da arena da fiber
+    fiberNode->cold->arena = NULL;
+    fiberNode->cold->arenaSize = spec->arenaSize;
+    if(spec->arenaSize != 0){
+        fiberNode->cold->arena = allocArenaBlock(spec->arenaSize);
+        if(fiberNode->cold->arena == NULL){
+            freeFiber(fiberNode);
+            if(admitted)
+                leaveAdmission();
+            return ERR_MALL;
+        }
+    }
+
+    // Registrando a rotina da fiber. A pilha e o contexto ficam para o primeiro despacho
+    fiberNode->cold->routine = start_routine;
+    fiberNode->cold->arg = arg;
+    runtime->lazyFibers++;
+
+    // Fibers com área reservada na pilha precisam dela agora
+    if(spec->storageSize != 0){
+        err = materializeFiber(fiberNode, spec, 0);
+        if(err != 0){
+            runtime->lazyFibers--;
+            releaseArena(fiberNode->cold->arena);
+            freeFiber(fiberNode);
+            if(admitted)
+                leaveAdmission();
+            return err;
+        }
+    }
+
+    // Inicializando a struct recém-criada que armazena a fiber 
+    fiberNode->prev = NULL;
+    fiberNode->next = NULL;
+    fiberNode->status = READY;
+    fiberNode->readySince = runtime->latency != NULL ? monotonicNs() : 0;
+    fiberNode->joinWoken = 0;
+    fiberNode->cold->retval = NULL;
+    fiberNode->cold->join_retval = NULL;
+    fiberNode->joinFiber = NULL;
+    fiberNode->cold->waitingList = NULL;
+    memset(fiberNode->cold->value, 0, FIBER_INLINE_RETVAL);
+    fiberNode->cold->dispose = spec->dispose;
+    fiberNode->cold->joinable = spec->dispose != NULL;
+    fiberNode->cold->retvalTaken = 0;
+    fiberNode->cold->generator = NULL;
+
+    // Inserindo a nova fiber na lista de fibers. A partir daqui, ela já é contada pelo nFibers
+    pushFiber(fiberNode);
+    if(admitted)
+        leaveAdmission();
+
+    // Atribuindo o id da fiber adequadamente
+    * fiber = fiberNode->fiberId;
+
+    traceEvent(TRACE_CREATE, fiberNode->fiberId, 0);
+
+    // Verificando se o escalonador já começou a rodar.
+    // Caso não tenha, startFibers() é chamada e o contexto
+    // da thread principal é capturado.
+    if (runtime->f_list->started == 0) {
+        runtime->f_list->started = 1;
+        startFibers();
+
+        // O primeiro runtime iniciado passa a executar as tarefas da fiber_post
+        FiberRuntime * noOwner = NULL;
+        atomic_compare_exchange_strong(&posted.owner, &noOwner, runtime);
+
+        // Obtendo o contexto da thread atual e o transferindo para o currentContext
+        if(getcontext(runtime->f_list->fibers->cold->context) == -1){
+            perror("Ocorreu um erro no getcontext da fiber_create");
+            return ERR_GTCTX;
+        }
+    }
+
+    return 0;
+}
+
+/*
+    fiber_create
+    ------------
+
+    Cria uma fiber(user-level thread) que executará a rotina(função)
+    start_routine, recebendo o parâmetro arg. Caso a fiber seja criada
+    corretamente, ela será inserida na lista de fibers, e seu id será
+    transferido para o endereço apontado por *fiber.
+
+    Caso start_routine retorne, a fiber termina como se tivesse chamado
+    fiber_exit() com o valor retornado(ver fiberMain).
+
+    A pilha da fiber só é alocada quando ela executa pela primeira
+    vez: criar fibers que nunca chegam a executar custa apenas o seu
+    cabeçalho.
+    Caso a pilha não possa ser alocada nesse momento, a fiber termina
+    sem executar, e a fiber_join() nela retorna ERR_MALL.
+
+*/
+int fiber_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg) {
+    return createFiber(fiber, start_routine, arg, NULL);
+}
+
+/*
+    fiber_create_arena
+    ------------------
+
+    Igual à fiber_create(), mas a fiber criada recebe uma arena com 
+    blocos de arenaSize bytes, da qual ela pode alocar memória com 
+    fiber_alloc(). Toda a memória da arena é liberada de uma só vez 
+    quando a fiber é destruída, após ter terminado.
+
+*/
+int fiber_create_arena(fiber_t *fiber, void *(*start_routine) (void *), void *arg, size_t arenaSize) {
+    FiberSpec spec = { .arenaSize = arenaSize };
+
+    if(arenaSize == 0)
+        return ERR_SIZE;
+    return createFiber(fiber, start_routine, arg, &spec);
+}
+
+/*
+    fiber_create_closure
+    --------------------
+
+    Igual à fiber_create(), mas ao invés de receber um argumento pronto,
+    reserva size bytes(alinhados a CLOSURE_ALIGN) no topo da pilha da 
+    nova fiber e chama init(area, ctx) para que eles sejam preenchidos
+    antes que a fiber possa executar. O endereço da área é passado 
+    para start_routine como argumento. Assim, o estado da rotina(uma
+    closure, por exemplo) é guardado sem nenhuma alocação extra.
+
+    Caso dispose não seja NULL, a fiber é criada como joinable: depois
+    de terminada, ela é mantida na lista até que alguma fiber dê join
+    nela ou ela seja desanexada com fiber_detach(). Caso ela seja 
+    destruída sem que seu retval tenha sido recebido por um join, 
+    dispose(retval) é chamada. A destruição é sempre feita por uma 
+    troca de contexto fora do tratador do sinal do escalonador(ou pela
+    destruição do runtime, quando a thread termina), nunca durante uma
+    preempção: dispose pode alocar e liberar memória.
+
+    size deve ser menor que metade do tamanho da pilha.
+
+*/
+int fiber_create_closure(fiber_t *fiber, void *(*start_routine) (void *), size_t size,
+                         void (*init)(void *storage, void *ctx), void *ctx, void (*dispose)(void *retval)) {
+    FiberSpec spec = { .storageSize = size, .init = init, .ctx = ctx, .dispose = dispose };
+
+    if(init == NULL)
+        return ERR_NULLID;
+    if(size == 0 || size > FIBER_STACK / 2)
+        return ERR_SIZE;
+    return createFiber(fiber, start_routine, NULL, &spec);
+}
+
+/*
+    waitFiber
+    ---------
+
+    Implementação da fiber_join() e da fiber_join_value(). Faz com que
+    a fiber atual espere o término da fiber com o id fiber e, depois 
+    disso, transfere o retval dela para *retval(caso retval não seja
+    NULL) e os size primeiros bytes do seu valor de retorno inline para
+    value(caso value não seja NULL).
+
+*/
+int waitFiber(fiber_t fiber, void **retval, void *value, size_t size){
+
+    // Tentando encontrar a fiber com o id fiber
+    Fiber * fiberNode = findFiber(fiber);
+
+    // Se a fiber não foi encontrada na lista
+    if(fiberNode == NULL)
+        return ERR_NOTFOUND;
+
+    // Se a fiber a ser esperada é a que está executando
+    if(fiberNode->fiberId == runtime->f_list->currentFiber->fiberId)
+        return ERR_JOINCRRT;
+
+    // Se a fiber que deveria terminar antes já terminou
+    if(fiberNode->status == FINISHED){
+        releaseFibers(fiberNode);
+        fiberNode->cold->retvalTaken = 1;
+        fiberNode->cold->joinable = 0;
+        if(retval != NULL)
+            *retval = fiberNode->cold->retval;
+        if(value != NULL)
+            memcpy(value, fiberNode->cold->value, size);
+        return fiberNode->cold->error;
+    } 
+        
+
+	// Criando um nodo para a lista de espera da fiber que será aguardada
+    Waiting * waitingNode = (Waiting *) malloc(sizeof(Waiting));
+
+    // Caso a alocação falhe
+    if (waitingNode == NULL) {
+        perror("erro malloc na fiber_join");
+        return ERR_MALL;
+    }
+
+    // Atribuindo o id do nodo(id da fiber que irá esperar) e inicializando seu ponteiro next
+    waitingNode->waitingId = runtime->f_list->currentFiber->fiberId;
+    waitingNode->next = NULL;
+
+    // Parar o timer, área crítica
+    stopTimer(NULL);
+
+    // Adicionando um nodo na lista de espera da fiber a ser aguardada
+    if(fiberNode->cold->waitingList == NULL){
+        fiberNode->cold->waitingList = (Waiting *) waitingNode;     
+    }  
+    else{
+        Waiting * waitingTop = (Waiting *) fiberNode->cold->waitingList;
+        fiberNode->cold->waitingList = (Waiting *) waitingNode;
+        fiberNode->cold->waitingList->next = (Waiting *) waitingTop;
+    }
+
+    // Definindo a fiber que a fiber atual está esperando
+    runtime->f_list->currentFiber->joinFiber = (Fiber *) fiberNode;
+
+    // Marcando a fiber atual como esperando
+    runtime->f_list->currentFiber->status = WAITING;  
+
+    traceEvent(TRACE_JOIN_BLOCK, runtime->f_list->currentFiber->fiberId, 0);
+    switchOut(runtime->f_list->currentFiber, TRACE_JOINED);
+
+    // Trocando para a próxima fiber
+    if(schedule(0) == -1){
+    	perror("Ocorreu um erro no swapcontext da fiber_join");
+    	return ERR_SWPCTX;
+    }
+
+    // Recuperando o valor de retorno da fiber que estava sendo aguardada.
+	// Caso NULL tenha sido passado como argumento para retval, nada mais é feito.
+    // Caso a fiber que estava sendo aguardada por esta tenha sido destruída,
+    // as rotinas de destruição já distribuíram os valores de retval corretamente
+    // para os atributos join_retval das fibers que estavam aguardando-a.
+    if(value != NULL){
+        // O valor inline segue a mesma lógica do retval abaixo
+        if(runtime->f_list->currentFiber->joinFiber != NULL)
+            memcpy(value, runtime->f_list->currentFiber->joinFiber->cold->value, size);
+        else
+            memcpy(value, runtime->f_list->currentFiber->cold->join_value, size);
+    }
+
+	if(retval != NULL){
+        // Caso a joinFiber não tenha sido liberada pela releaseFibers(), ela ainda não foi
+        // destruída e o retval é recuperado diretamente dela
+		if(runtime->f_list->currentFiber->joinFiber != NULL)
+			*retval = runtime->f_list->currentFiber->joinFiber->cold->retval;
+        // Caso contrário, o retval é recuperado do atributo join_retval da própria fiber que chamou
+        // fiber_join()
+		else 
+			*retval = runtime->f_list->currentFiber->cold->join_retval;
+		
+		// Resetando os retvals da fiber
+		runtime->f_list->currentFiber->cold->retval = NULL;
+		runtime->f_list->currentFiber->cold->join_retval = NULL;
+	}
+
+    // Erro que impediu a fiber aguardada de executar, com a mesma lógica do retval
+    int err = runtime->f_list->currentFiber->cold->join_error;
+    if(runtime->f_list->currentFiber->joinFiber != NULL)
+        err = runtime->f_list->currentFiber->joinFiber->cold->error;
+    runtime->f_list->currentFiber->cold->join_error = 0;
+
+    // A fiber aguardada pode ser destruída a partir daqui
+    if(runtime->f_list->currentFiber->joinFiber != NULL){
+        runtime->f_list->currentFiber->joinFiber->cold->retvalTaken = 1;
+        runtime->f_list->currentFiber->joinFiber->cold->joinable = 0;
+    }
+    runtime->f_list->currentFiber->joinFiber = NULL;
+
+    // Definindo o status da fiber atual como pronta para executar
+    runtime->f_list->currentFiber->status = READY;
+
+    return err;
+}
+
+/*
+    fiber_join
+    ----------
+
+    Faz com que a fiber atual espere o término de outra fiber para começar a executar.
+    Caso o ponteiro recebido por retval não seja NULL, a função transferirá o endereço
+    de memória do valor de retorno da fiber que estava sendo aguardada para ele, para que
+    este possa permitir que o usuário da biblioteca recupere esse valor de retorno e o use.
+
+    A alocação de memória necessária para o ponteiro duplo(void ** retval) é de total
+    responsabilidade do usuário da biblioteca.
+
+    Caso a fiber aguardada tenha terminado sem executar, por não ter sido possível
+    alocar sua pilha, retorna ERR_MALL(e *retval recebe NULL).
+
+*/
+int fiber_join(fiber_t fiber, void **retval){
+    return waitFiber(fiber, retval, NULL, 0);
+}
+
+/*
+    fiber_join_value
+    ----------------
+
+    Igual à fiber_join(), mas, ao invés de um ponteiro, copia para value
+    os size primeiros bytes do valor de retorno que a fiber aguardada 
+    passou por valor para a fiber_exit_value(). Nenhuma alocação é 
+    necessária, nem pela fiber aguardada, nem pela que a espera.
+    
+    O tamanho máximo é FIBER_INLINE_RETVAL bytes. Caso a fiber aguardada
+    tenha terminado com fiber_exit(), ou passado menos bytes, os bytes
+    restantes serão zero.
+
+*/
+int fiber_join_value(fiber_t fiber, void *value, size_t size){
+    if(value == NULL)
+        return ERR_NULLID;
+    if(size > FIBER_INLINE_RETVAL)
+        return ERR_SIZE;
+    return waitFiber(fiber, NULL, value, size);
+}
+
+/*
+    fiber_detach
+    ------------
+
+    Desanexa a fiber com o id fiber: depois de terminada, ela será 
+    destruída pelo escalonador mesmo que nenhuma fiber dê join nela.
+    Só faz diferença para fibers criadas pela fiber_create_closure().
+
+*/
+int fiber_detach(fiber_t fiber){
+    Fiber * fiberNode = findFiber(fiber);
+
+    if(fiberNode == NULL)
+        return ERR_NOTFOUND;
+
+    fiberNode->cold->joinable = 0;
+    return 0;
+}
+
+/*
+    fiber_exit
+    ----------
+
+    Para a execução da fiber atual e altera seu status para FINISHED.
+    Com seu status FINISHED, essa fiber nunca mais será executada, e
+    ao ser identificada pelo escalonador, terá sua área de memória
+    liberada, após ter corretamente transferido o endereço de memória
+    de retval para as fibers que a estavam esperando e as liberado para
+    serem executadas pelo escalonador, caso existam.
+
+    A alocação de memória necessária para o ponteiro retval é de total
+    responsabilidade do usuário da biblioteca, e caso um valor nulo 
+    seja recebido em seu lugar, esse valor será simplesmente ignorado
+    pelas rotinas que fazem uso dele.
+
+    Caso alguma fiber esteja esperando esta, a CPU é passada diretamente
+    para ela, sem passar pelo escalonador.
+
+*/
+void fiber_exit(void *retval){
+    // Sem fibers, apenas a thread termina
+    if(runtime == NULL || runtime->f_list == NULL){
+        if(gettid() == getpid())
+            exit(0);
+        pthread_exit(NULL);
+    }
+
+    // A própria fiber de uma thread que não é a principal salva aqui o contexto
+    // para o qual o escalonador volta quando todas as fibers da thread terminam
+    if(runtime->f_list->currentFiber->cold->routine == NULL && gettid() != getpid()){
+        getcontext(&runtime->exitContext);
+        if(runtime->exiting)
+            pthread_exit(NULL);
+    }
+
+    Fiber * current = runtime->f_list->currentFiber;
+
+    // Parar o timer, área crítica
+    stopTimer(NULL);
+
+    // Instanciando o valor de retorno da fiber
+    current->cold->retval = retval;
+    // Definindo status da fiber atual como terminada
+    current->status = FINISHED;
+
+    traceEvent(TRACE_EXIT, current->fiberId, 0);
+
+    // Liberando as fibers esperando esta e passando a CPU diretamente para uma delas
+    Fiber * joiner = releaseFibers(current);
+
+    // Caso esta seja o produtor de um generator, a CPU volta para o consumidor
+    Generator * gen = current->cold->generator;
+    if(gen != NULL){
+        gen->done = 1;
+        if(gen->consumer != NULL && gen->consumer->status == SUSPENDED){
+            gen->consumer->status = READY;
+            joiner = gen->consumer;
+        }
+    }
+
+    if(joiner != NULL){
+        switchOut(current, TRACE_EXITED);
+        if(switchFiber(current, joiner) == -1)
+            perror("Ocorreu um erro no setcontext da fiber_exit");
+    }
+
+    // Chamando o escalonador corretamente
+    timeHandler(0);
+}
+
+/*
+    fiber_exit_value
+    ----------------
+
+    Igual à fiber_exit(), mas o valor de retorno(de até FIBER_INLINE_RETVAL
+    bytes) é passado por valor: size bytes a partir de value são copiados 
+    para a estrutura da própria fiber e, de lá, para as fibers que a 
+    aguardam com fiber_join_value(). Nenhuma alocação é necessária, e 
+    value pode apontar para uma variável local.
+
+    Caso size seja maior que FIBER_INLINE_RETVAL, retorna ERR_SIZE e a 
+    fiber continua executando. Caso contrário, não retorna.
+
+*/
+int fiber_exit_value(const void *value, size_t size){
+    if(size > FIBER_INLINE_RETVAL)
+        return ERR_SIZE;
+
+    // Sem fibers criadas, não há estrutura onde guardar o valor: a 
+    // fiber_exit() apenas termina a thread
+    if(runtime == NULL || runtime->f_list == NULL)
+        fiber_exit(NULL);
+
+    // Copiando o valor de retorno para a estrutura da fiber
+    if(value != NULL)
+        memcpy(runtime->f_list->currentFiber->cold->value, value, size);
+
+    fiber_exit(NULL);
+    return 0;
+}
+
+/*
+    fiber_switch_to
+    ---------------
+
+    Passa a CPU diretamente da fiber atual para a fiber com o id fiber,
+    com uma única troca de contexto e sem passar pelo escalonador(útil
+    quando a fiber atual acabou de liberar trabalho para outra). A fiber
+    atual continua pronta e volta a executar na sua vez, e a fiber de 
+    destino recebe um timeslice completo.
+
+    Retorna ERR_NOTFOUND caso a fiber não exista, ERR_JOINCRRT caso ela
+    seja a própria fiber atual e ERR_NOTREADY caso ela não esteja pronta
+    para executar(esperando um join ou uma rotina da fiber_offload, ou
+    terminada).
+
+*/
+int fiber_switch_to(fiber_t fiber){
+    struct itimerspec restored;
+
+    // Tentando encontrar a fiber com o id fiber
+    Fiber * target = findFiber(fiber);
+    if(target == NULL)
+        return ERR_NOTFOUND;
+
+    Fiber * current = runtime->f_list->currentFiber;
+    if(target == current)
+        return ERR_JOINCRRT;
+
+    // Parar o timer, área crítica
+    stopTimer(&restored);
+
+    if(target->status != READY){
+        restoreTimer(&restored);
+        return ERR_NOTREADY;
+    }
+
+    // Montando a pilha da fiber caso ela ainda não tenha executado
+    int err = materializeFiber(target, NULL, 0);
+    if(err != 0){
+        restoreTimer(&restored);
+        return err;
+    }
+
+    switchOut(current, TRACE_HANDOFF);
+
+    // Trocando diretamente para a fiber de destino
+    if(switchFiber(current, target) == -1){
+    	perror("Ocorreu um erro no swapcontext da fiber_switch_to");
+    	return ERR_SWPCTX;
+    }
+
+    return 0;
+}
+
+/*
+    fiber_trace_start
+    -----------------
+
+    Liga o tracer de escalonamento da thread atual, pré-alocando um
+    buffer circular para capacity eventos(arredondado para a próxima
+    potência de 2).
+    A partir daí, criações, entradas e saídas(com o motivo), términos,
+    bloqueios em joins e liberações de fibers são registrados até que
+    fiber_trace_stop() seja chamada. Caso o tracer já esteja ligado, 
+    o buffer antigo é descartado.
+
+*/
+int fiber_trace_start(unsigned long capacity){
+    uint64_t size = 1;
+
+    if(getRuntime() == NULL)
+        return ERR_MALL;
+
+    // Arredondando a capacidade para uma potência de 2
+    while(size < capacity)
+        size <<= 1;
+
+    TraceEvent * events = (TraceEvent *) malloc(size * sizeof(TraceEvent));
+    if(events == NULL){
+        perror("erro malloc na criação do buffer da fiber_trace_start");
+        return ERR_MALL;
+    }
+
+    // Descartando um buffer anterior
+    free(runtime->tracer.events);
+
+    runtime->tracer.mask = size - 1;
+    runtime->tracer.next = 0;
+    runtime->tracer.ticksStart = traceClock();
+    runtime->tracer.nsStart = monotonicNs();
+    runtime->tracer.events = events;
+
+    // A fiber atual já está executando quando o trace começa
+    traceEvent(TRACE_SWITCH_IN, runtime->f_list != NULL ? runtime->f_list->currentFiber->fiberId : PARENT_ID, 0);
+
+    return 0;
+}
+
+/*
+    fiber_trace_dump
+    ----------------
+
+    Grava os eventos presentes no buffer do tracer no arquivo path, 
+    no formato binário descrito pela TraceHeader. O arquivo pode ser
+    convertido para o formato JSON do Chrome/Perfetto com o programa
+    fibertrace. O tracer continua ligado.
+
+*/
+int fiber_trace_dump(const char *path){
+    TraceHeader header;
+    uint64_t i, first;
+    struct itimerspec restored;
+
+    if(runtime == NULL || runtime->tracer.events == NULL)
+        return ERR_NOTFOUND;
+
+    FILE * file = fopen(path, "wb");
+    if(file == NULL){
+        perror("erro fopen na fiber_trace_dump");
+        return ERR_IO;
+    }
+
+    // Para o timer para que nenhum evento seja registrado durante a gravação
+    stopTimer(&restored);
+
+    // Eventos mais antigos que a capacidade do buffer foram sobrescritos
+    first = runtime->tracer.next > runtime->tracer.mask + 1 ? runtime->tracer.next - (runtime->tracer.mask + 1) : 0;
+
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.nEvents = runtime->tracer.next - first;
+    header.lost = first;
+    header.ticksStart = runtime->tracer.ticksStart;
+    header.nsStart = runtime->tracer.nsStart;
+    header.ticksEnd = traceClock();
+    header.nsEnd = monotonicNs();
+
+    int err = fwrite(&header, sizeof(header), 1, file) != 1;
+    for(i = first; i < runtime->tracer.next && !err; i++)
+        err = fwrite(&runtime->tracer.events[i & runtime->tracer.mask], sizeof(TraceEvent), 1, file) != 1;
+
+    if(fclose(file) != 0)
+        err = 1;
+
+    if(runtime->f_list != NULL && runtime->f_list->started)
+        restoreTimer(&restored);
+
+    if(err){
+        perror("erro na gravação do arquivo da fiber_trace_dump");
+        return ERR_IO;
+    }
+    return 0;
+}
+
+/*
+    fiber_trace_stop
+    ----------------
+
+    Desliga o tracer e libera seu buffer. Eventos ainda não gravados
+    com fiber_trace_dump() são descartados.
+
+*/
+void fiber_trace_stop(){
+    if(runtime == NULL)
+        return;
+
+    TraceEvent * events = runtime->tracer.events;
+    runtime->tracer.events = NULL;
+    free(events);
+}
+
+/*
+    profHandler
+    -----------
+
+    Tratador do sinal SIGPROF. Reserva uma posição no buffer do profiler
+    e grava nela a fiber atual, sua rotina e a pilha de chamadas 
+    interrompida. Não faz alocações nem usa locks.
+
+*/
+void profHandler(){
+    void * frames[PROFILE_DEPTH + PROFILE_SKIP];
+    ProfileSample * samples = profiler.samples;
+
+    // O SIGPROF é do processo: só são amostradas as threads com fibers executando
+    if(samples == NULL || runtime == NULL || runtime->f_list == NULL || !runtime->f_list->started)
+        return;
+
+    // Reservando uma posição no buffer
+    unsigned long index = __atomic_fetch_add(&profiler.next, 1, __ATOMIC_RELAXED);
+    if(index >= profiler.capacity)
+        return;
+
+    ProfileSample * sample = &samples[index];
+    Fiber * fiber = runtime->f_list->currentFiber;
+    FiberCold * cold = fiber->cold;
+
+    sample->fiberId = fiber->fiberId;
+    sample->routine = cold != NULL ? cold->routine : NULL;
+
+    // Obtendo a pilha, sem os frames do próprio tratador
+    int depth = backtrace(frames, PROFILE_DEPTH + PROFILE_SKIP) - PROFILE_SKIP;
+    if(depth < 0)
+        depth = 0;
+    memcpy(sample->frames, frames + PROFILE_SKIP, depth * sizeof(void *));
+    sample->depth = depth;
+
+    __atomic_store_n(&sample->ready, 1, __ATOMIC_RELEASE);
+}
+
+/*
+    uninstallProfiler
+    -----------------
+
+    Retira o buffer de amostras do profiler e o libera, quando o 
+    profiler não pôde ser ligado.
+
+*/
+void uninstallProfiler(){
+    ProfileSample * samples = profiler.samples;
+    profiler.samples = NULL;
+    profiler.capacity = 0;
+    profiler.next = 0;
+    free(samples);
+}
+
+/*
+    fiber_profile_start
+    -------------------
+
+    Liga o profiler por amostragem: hz vezes por segundo de CPU consumida
+    pelo processo, o sinal SIGPROF é recebido e a fiber em execução, sua
+    rotina e sua pilha de chamadas são gravadas em um buffer pré-alocado
+    com espaço para maxSamples amostras. Amostras de uma execução 
+    anterior do profiler são descartadas.
+
+    Retorna ERR_NULLID caso hz ou maxSamples sejam inválidos, ERR_MALL
+    caso o buffer não possa ser alocado e ERR_IO caso o tratador do 
+    sinal ou o timer não possam ser instalados(nesse caso, o buffer é
+    liberado e o profiler continua desligado).
+
+*/
+int fiber_profile_start(int hz, unsigned long maxSamples){
+    struct sigaction sa, previous;
+    struct itimerval profTimer;
+    void * warmup[1];
+
+    if(hz <= 0 || maxSamples == 0)
+        return ERR_NULLID;
+
+    ProfileSample * samples = (ProfileSample *) calloc(maxSamples, sizeof(ProfileSample));
+    if(samples == NULL){
+        perror("erro calloc na criação do buffer da fiber_profile_start");
+        return ERR_MALL;
+    }
+
+    // A primeira chamada da backtrace() carrega a libgcc, o que não pode ser feito no tratador
+    backtrace(warmup, 1);
+
+    free(profiler.samples);
+    profiler.capacity = maxSamples;
+    profiler.next = 0;
+    profiler.samples = samples;
+
+    // O escalonador não pode interromper o tratador do SIGPROF
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &profHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaddset(&sa.sa_mask, SIGVTALRM);
+    if(sigaction(SIGPROF, &sa, &previous) == -1){
+        perror("Ocorreu um erro no sigaction da fiber_profile_start");
+        uninstallProfiler();
+        return ERR_IO;
+    }
+
+    // Iniciando o timer de profiling
+    profTimer.it_interval.tv_sec = 0;
+    profTimer.it_interval.tv_usec = hz >= 1000000 ? 1 : 1000000 / hz;
+    profTimer.it_value = profTimer.it_interval;
+    if(setitimer(ITIMER_PROF, &profTimer, NULL) == -1){
+        perror("Ocorreu um erro no setitimer da fiber_profile_start");
+        sigaction(SIGPROF, &previous, NULL);
+        uninstallProfiler();
+        return ERR_IO;
+    }
+
+    return 0;
+}
+
+/*
+    fiber_profile_stop
+    ------------------
+
+    Para o timer do profiler. As amostras coletadas continuam 
+    disponíveis para a fiber_profile_dump().
+
+*/
+void fiber_profile_stop(){
+    struct itimerval profTimer;
+    memset(&profTimer, 0, sizeof(profTimer));
+    if(setitimer(ITIMER_PROF, &profTimer, NULL) == -1)
+        perror("Ocorreu um erro no setitimer da fiber_profile_stop");
+}
+
+/*
+    compareStacks
+    -------------
+
+    Compara duas pilhas já convertidas para texto, para que pilhas
+    iguais fiquem adjacentes após a ordenação.
+
+*/
+int compareStacks(const void * a, const void * b){
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+    writeSymbol
+    -----------
+
+    Escreve em file o nome do símbolo que contém o endereço addr, ou 
+    o nome do módulo e o deslocamento caso o símbolo não seja conhecido
+    (o programa deve ser ligado com -rdynamic para que os símbolos dele
+    próprio sejam encontrados).
+
+*/
+void writeSymbol(FILE * file, void * addr){
+    Dl_info info;
+
+    // Endereço fora de qualquer módulo carregado
+    if(dladdr(addr, &info) == 0 || info.dli_fname == NULL){
+        fprintf(file, "0x%lx", (unsigned long) addr);
+        return;
+    }
+
+    if(info.dli_sname != NULL){
+        fprintf(file, "%s", info.dli_sname);
+    }
+    else{
+        // Apenas o nome do arquivo do módulo, sem o diretório
+        const char * module = strrchr(info.dli_fname, '/');
+        module = module != NULL ? module + 1 : info.dli_fname;
+        fprintf(file, "%s+0x%lx", module, (unsigned long) ((char *) addr - (char *) info.dli_fbase));
+    }
+}
 
-    // Obtendo o endereço da fiber que sucede a fiber que será destruída
-    Fiber * nextFiber = (Fiber *) fiber->next;
+/*
+    fiber_profile_dump
+    ------------------
 
-    // Caso os ponteiros next e prev da fiber não forem nulos
-	if(nextFiber != NULL && prevFiber != NULL){
-		// Removendo a fiber da lista circular
-		nextFiber->prev = (Fiber *) prevFiber; 
-		prevFiber->next = (Fiber *) nextFiber;
-	}    
+    Grava as amostras coletadas no arquivo path, no formato "folded 
+    stacks" lido por ferramentas de flamegraph: uma linha por pilha
+    distinta, com os frames separados por ';' a partir da raiz, seguidos
+    pela quantidade de amostras. O primeiro frame é a fiber(fiber_<id>)
+    e o segundo é a rotina dela, de forma que as pilhas de cada fiber 
+    fiquem separadas mesmo que comecem no makecontext.
 
-    // Se a fiber na cabeça da lista for destruída
-	if(id == f_list->fibers->fiberId)
-		f_list->fibers = nextFiber; // Instanciar corretamente a cabeça da lista como a próxima fiber
-    
-	
-    // Destruindo a fiber
-    free(fiber->context.uc_stack.ss_sp);
-    free(fiber);
-	fiber = NULL;
+*/
+int fiber_profile_dump(const char *path){
+    unsigned long i, n, count;
+    size_t size;
+    int j, err = 0;
 
-    // Diminuindo o número de fibers da lista
-    f_list->nFibers--;
+    if(profiler.samples == NULL)
+        return ERR_NOTFOUND;
 
-	// Caso a lista tinha sido esvaziada, preencha os ponteiros com NULL para evitar acesso indevido 
-    // de memória
-	if(f_list->nFibers == 0){
-		nextFiber = NULL;
-		prevFiber = NULL;
-	}
-	
-    return nextFiber;
+    // Desligando o profiler para que o buffer não seja modificado
+    fiber_profile_stop();
+    ProfileSample * samples = profiler.samples;
+    n = profiler.next < profiler.capacity ? profiler.next : profiler.capacity;
+
+    char ** stacks = (char **) calloc(n + 1, sizeof(char *));
+    if(stacks == NULL){
+        perror("erro calloc na fiber_profile_dump");
+        return ERR_MALL;
+    }
+
+    // Convertendo as pilhas completas para texto
+    for(i = 0, count = 0; i < n && !err; i++){
+        if(!__atomic_load_n(&samples[i].ready, __ATOMIC_ACQUIRE))
+            continue;
+
+        FILE * line = open_memstream(&stacks[count], &size);
+        if(line == NULL){
+            err = 1;
+            break;
+        }
+
+        if(samples[i].fiberId == PARENT_ID)
+            fprintf(line, "fiber_main");
+        else
+            fprintf(line, "fiber_%d", samples[i].fiberId);
+
+        if(samples[i].routine != NULL){
+            fputc(';', line);
+            writeSymbol(line, (void *) samples[i].routine);
+        }
+
+        // Frames da raiz para o topo da pilha
+        for(j = samples[i].depth - 1; j >= 0; j--){
+            fputc(';', line);
+            writeSymbol(line, samples[i].frames[j]);
+        }
+
+        if(fclose(line) != 0)
+            err = 1;
+        count++;
+    }
+    n = count;
+
+    FILE * file = err ? NULL : fopen(path, "w");
+    if(file != NULL){
+        // Agrupando pilhas iguais
+        qsort(stacks, n, sizeof(char *), compareStacks);
+
+        for(i = 0; i < n; i += count){
+            for(count = 1; i + count < n && strcmp(stacks[i], stacks[i + count]) == 0; count++);
+            fprintf(file, "%s %lu\n", stacks[i], count);
+        }
+
+        if(fclose(file) != 0)
+            err = 1;
+    }
+    else 
+        err = 1;
+
+    for(i = 0; stacks[i] != NULL; i++)
+        free(stacks[i]);
+    free(stacks);
+
+    if(err){
+        perror("erro na gravação do arquivo da fiber_profile_dump");
+        return ERR_IO;
+    }
+    return 0;
 }
 
 /*
-    fiberScheduler
-    --------------
+    fiber_alloc
+    -----------
 
-    Toda vez que é chamada, verifica o status da fiber logo após a atual.
+    Aloca size bytes(alinhados a ARENA_ALIGN bytes) da arena da fiber 
+    atual, apenas incrementando um ponteiro. Quando o bloco atual da
+    arena se esgota, um novo bloco é obtido. A memória não deve ser 
+    liberada com free(): ela é liberada junto com a arena, quando a 
+    fiber é destruída. Por isso, ela também não deve ser usada como 
+    retval da fiber(fiber_exit_value() pode ser usada para isso).
 
-    Caso o status da próxima fiber não seja READY, o loop é executado e continuará
-    procurando fibers disponíveis para execução. Fibers com status WAITING poderão 
-    ser executadas, caso a fiber que elas estiverem esperando esteja terminada(status 
-    FINISHED), e terão seu status atualizado para READY novamente.  
-    
-    Fibers com status FINISHED nunca serão executadas, e, quando identificadas, terão 
-    suas waitingLists liberadas pela função releaseFibers(), que também instancia os 
-    ponteiros de valor de retorno adequadamente. Além disso, elas serão corretamente 
-    destruídas(terão sua memória liberada), e a lista de fibers será reconfigurada de 
-    acordo.
+    Retorna NULL caso a fiber atual não tenha arena ou a alocação falhe.
 
-    Ao encontrar uma fiber que tenha status READY, a fiber atual terá seu contexto salvo,
-    e o contexto atual será alterado para a fiber com status READY encontrada.
+*/
+void * fiber_alloc(size_t size){
+    if(runtime == NULL || runtime->f_list == NULL)
+        return NULL;
 
-    Quando a lista de fibers estiver completamente vazia, toda a memória alocada previamente
-    para estruturas da biblioteca será liberada, e o programa terminará. Caso alguma parte
-    desse processo falhe ou tenha comportamento inesperado, o programa terminará com retorno -1.
+    FiberCold * cold = runtime->f_list->currentFiber->cold;
+    ArenaBlock * block = cold->arena;
+    if(block == NULL)
+        return NULL;
+
+    // Alinhando a posição da próxima alocação
+    uintptr_t start = ((uintptr_t) (block->data + block->used) + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1);
+    size_t offset = start - (uintptr_t) block->data;
+
+    // Caso o bloco atual não tenha espaço, um novo bloco é colocado na frente da arena
+    if(offset > block->size || size > block->size - offset){
+        size_t blockSize = size + ARENA_ALIGN > cold->arenaSize ? size + ARENA_ALIGN : cold->arenaSize;
+        struct itimerspec restored;
+
+        // O pool de blocos é compartilhado pelas fibers
+        stopTimer(&restored);
+        ArenaBlock * newBlock = allocArenaBlock(blockSize);
+        restoreTimer(&restored);
+        if(newBlock == NULL)
+            return NULL;
+
+        newBlock->next = block;
+        cold->arena = block = newBlock;
+        start = ((uintptr_t) block->data + ARENA_ALIGN - 1) & ~(uintptr_t) (ARENA_ALIGN - 1);
+        offset = start - (uintptr_t) block->data;
+    }
+
+    block->used = offset + size;
+    return (void *) start;
+}
+
+/*
+    offloadWorker
+    -------------
 
+    Rotina das threads auxiliares da fiber_offload(): retira jobs da
+    fila de pendentes do pool arg, executa suas rotinas, insere-os na 
+    lista de concluídos e avisa o escalonador pelo eventFd. Termina
+    quando o runtime dono do pool termina(ver stopOffload).
 
 */
-void fiberScheduler() {
-    // Zerando o timer para pará-lo
+void * offloadWorker(void * arg){
+    OffloadPool * pool = (OffloadPool *) arg;
+    uint64_t one = 1;
+
+    for(;;){
+        // Esperando um job
+        pthread_mutex_lock(&pool->lock);
+        while(pool->jobs == NULL && !pool->stopping)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        if(pool->stopping){
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        OffloadJob * job = pool->jobs;
+        pool->jobs = job->next;
+        if(pool->jobs == NULL)
+            pool->jobsTail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        // Executando a rotina bloqueante
+        job->result = job->routine(job->arg);
+
+        // Devolvendo o job para o escalonador
+        pthread_mutex_lock(&pool->lock);
+        job->next = pool->done;
+        pool->done = job;
+        pthread_mutex_unlock(&pool->lock);
+
+        while(write(pool->eventFd, &one, sizeof(one)) == -1)
+            ;
+    }
+
+    return NULL;
+}
+
+/*
+    initOffload
+    -----------
+
+    Cria o eventFd e as threads auxiliares da fiber_offload(). As 
+    threads são criadas com todos os sinais bloqueados, para que os
+    sinais do escalonador e do profiler sejam sempre recebidos pela
+    thread das fibers.
+
+*/
+int initOffload(){
+    sigset_t all, old;
+    int i;
+
+    if(initEventFd() != 0)
+        return ERR_IO;
+
+    // As threads auxiliares herdam a máscara de sinais
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for(i = 0; i < OFFLOAD_THREADS; i++){
+        if(pthread_create(&runtime->offload.threads[i], NULL, offloadWorker, &runtime->offload) != 0)
+            break;
+        runtime->offload.nThreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(runtime->offload.nThreads == 0){
+        perror("Ocorreu um erro no pthread_create da initOffload");
+        return ERR_MALL;
+    }
+    return 0;
+}
+
+/*
+    stopOffload
+    -----------
+
+    Termina as threads auxiliares da fiber_offload() do runtime da 
+    thread atual e fecha o seu eventFd. Chamada pelo destrutor do 
+    runtime: as rotinas em execução terminam antes, e os jobs ainda
+    pendentes são descartados junto com as fibers que os enviaram.
+
+*/
+void stopOffload(){
+    int i;
+
+    pthread_mutex_lock(&runtime->offload.lock);
+    runtime->offload.stopping = 1;
+    pthread_cond_broadcast(&runtime->offload.cond);
+    pthread_mutex_unlock(&runtime->offload.lock);
+
+    for(i = 0; i < runtime->offload.nThreads; i++)
+        pthread_join(runtime->offload.threads[i], NULL);
+    runtime->offload.nThreads = 0;
+
+    if(runtime->offload.eventFd != -1){
+        close(runtime->offload.eventFd);
+        runtime->offload.eventFd = -1;
+    }
+}
+
+/*
+    fiber_offload
+    -------------
+
+    Executa a rotina bloqueante routine(arg)(uma chamada como getaddrinfo()
+    ou fsync(), por exemplo) em uma das threads auxiliares, e retorna o 
+    valor retornado por ela. Enquanto isso, a fiber atual fica parada, 
+    com status OFFLOADED, e as demais fibers continuam executando.
+
+    A rotina executa fora da thread das fibers, e por isso não pode
+    chamar nenhuma função da biblioteca. Caso as fibers ainda não 
+    estejam executando, ou as threads auxiliares não possam ser 
+    criadas, a rotina é executada diretamente pela fiber atual.
+
+*/
+void * fiber_offload(void *(*routine)(void *), void *arg){
+    OffloadJob job;
+
+    // Sem fibers para executar enquanto isso, ou sem threads auxiliares
+    if(runtime == NULL || runtime->f_list == NULL || !runtime->f_list->started || (runtime->offload.nThreads == 0 && initOffload() != 0))
+        return routine(arg);
+
+    // Parar o timer, área crítica
     stopTimer(NULL);
 
-    // Estrutura que armazenará a próxima fiber a ser executada
-    Fiber * nextFiber = (Fiber *) f_list->currentFiber->next;
-    
-    // Enquanto não encontrar uma fiber pronta para ser executada
-    while(nextFiber->status != READY) { 
-        // Caso a fiber já tenha terminado
-        if(nextFiber->status == FINISHED){
-            // Liberando as fibers esperando esta(caso existam)
-            releaseFibers(nextFiber->waitingList);
-            // Destruindo essa fiber e obtendo a próxima(caso exista)
-            nextFiber = fiber_destroy(nextFiber);
-            // Se a fiber_destroy retornar NULL
-            if(nextFiber == NULL){
-				// Caso não haja mais nenhuma fiber na lista
-                if(f_list->nFibers == 0){
-                    free(f_list); // Liberando a lista de fibers
-					free(schedulerContext.uc_stack.ss_sp); // Liberando a pilha do escalonador
-                    exit(0); // Terminando o programa
-                }
-				// Caso contrário, algum erro ocorreu
-				exit(-1); 
-            }
-        } 
-        // Caso a thread atual esteja num join
-        if(nextFiber->status == WAITING) { 
-            // Caso a thread que ela está esperando não estiver encerrada
-            if(nextFiber->joinFiber->status != FINISHED)
-                nextFiber = (Fiber *) nextFiber->next; // Pula a thread que está esperando
-            // Caso a thread que ela está esperando tenha terminado
-            else 
-				nextFiber->status = READY; // Definir o status como READY
-            
+    job.routine = routine;
+    job.arg = arg;
+    job.result = NULL;
+    job.fiber = runtime->f_list->currentFiber;
+    job.next = NULL;
+
+    // Inserindo o job na fila de pendentes
+    pthread_mutex_lock(&runtime->offload.lock);
+    if(runtime->offload.jobsTail == NULL)
+        runtime->offload.jobs = &job;
+    else
+        runtime->offload.jobsTail->next = &job;
+    runtime->offload.jobsTail = &job;
+    pthread_cond_signal(&runtime->offload.cond);
+    pthread_mutex_unlock(&runtime->offload.lock);
+
+    // Marcando a fiber atual como esperando a rotina
+    runtime->offload.pending++;
+    runtime->f_list->currentFiber->status = OFFLOADED;
+
+    switchOut(runtime->f_list->currentFiber, TRACE_OFFLOADED);
+
+    // Trocando para a próxima fiber
+    if(schedule(0) == -1){
+    	perror("Ocorreu um erro no swapcontext da fiber_offload");
+    	return NULL;
+    }
+
+    return job.result;
+}
+
+/*
+    fiber_post
+    ----------
+
+    Envia, de qualquer thread, uma tarefa para ser executada por uma nova
+    fiber, que executará routine(arg). A tarefa é inserida em uma fila 
+    lock-free com um único compare-and-swap, e o escalonador dono da
+    fila(o da primeira thread que começou a executar fibers) insere a 
+    fiber na lista na sua próxima troca de fiber, inclusive em uma 
+    preempção. O cabeçalho e os dados frios da fiber são alocados aqui,
+    pelo produtor, para que o escalonador não precise alocar memória. 
+    Caso ele esteja dormindo por não haver fibers prontas, ele é acordado.
+
+    A fiber criada não é joinable, e seu id não é informado. As tarefas
+    só são executadas depois que as fibers começarem a executar.
+
+*/
+int fiber_post(void *(*routine)(void *), void *arg){
+    uint64_t one = 1;
+
+    if(routine == NULL)
+        return ERR_NULLID;
+
+    // O cabeçalho da fiber ocupa uma linha de cache
+    PostedTask * task = (PostedTask *) aligned_alloc(CACHE_LINE, sizeof(PostedTask));
+    if(task == NULL){
+        perror("erro aligned_alloc na criação da tarefa da fiber_post");
+        return ERR_MALL;
+    }
+    memset(task, 0, sizeof(PostedTask));
+    task->fiber.cold = &task->cold;
+    task->cold.routine = routine;
+    task->cold.arg = arg;
+    task->cold.posted = 1;
+
+    // Inserindo a tarefa no topo da pilha
+    task->next = atomic_load_explicit(&posted.head, memory_order_relaxed);
+    while(!atomic_compare_exchange_weak(&posted.head, &task->next, task))
+        ;
+
+    // Acordando o escalonador dono da fila, caso ele esteja dormindo
+    if(atomic_load(&posted.sleeping))
+        while(write(posted.eventFd, &one, sizeof(one)) == -1)
+            ;
+
+    return 0;
+}
+
+/*
+    generatorMain
+    -------------
+
+    Rotina da fiber produtora de um generator: executa a rotina do 
+    produtor e termina a fiber com o valor retornado por ela, o que
+    devolve a CPU para o consumidor(ver fiber_exit).
+
+*/
+void * generatorMain(void * arg){
+    Generator * gen = (Generator *) arg;
+
+    fiber_exit(gen->routine(gen->arg));
+    return NULL;
+}
+
+/*
+    generator_create
+    ----------------
+
+    Cria um generator cuja fiber produtora executará routine(arg). A 
+    rotina só começa a executar na primeira chamada à generator_next(),
+    e passa cada valor produzido para o consumidor com a 
+    fiber_yield_value(). O generator termina quando a rotina retorna
+    ou chama fiber_exit().
+
+*/
+int generator_create(generator_t **gen, void *(*routine)(void *), void *arg){
+    fiber_t producerId = 0;
+    int err;
+    FiberSpec spec = { .admitted = 0 };
+
+    if(gen == NULL || routine == NULL)
+        return ERR_NULLID;
+    if(getRuntime() == NULL)
+        return ERR_MALL;
+
+    Generator * newGen = (Generator *) malloc(sizeof(Generator));
+    if(newGen == NULL){
+        perror("erro malloc na criação do generator da generator_create");
+        return ERR_MALL;
+    }
+    newGen->consumer = NULL;
+    newGen->routine = routine;
+    newGen->arg = arg;
+    newGen->value = NULL;
+    newGen->done = 0;
+
+    // Reservando a vaga antes de adiar a preempção, já que a espera por ela para a fiber atual na fiber_wait
+    if(runtime->admission.maxFibers > 0 || runtime->admission.maxStackBytes > 0){
+        err = admitFiber(0);
+        if(err != 0){
+            free(newGen);
+            return err;
         }
-    } 
-        
-    // Definindo a próxima fiber selecionada como a fiber atual
-	f_list->currentFiber = (Fiber *) nextFiber;
+        spec.admitted = 1;
+    }
 
-    // Redefinindo o timer para o tempo normal
-    timer.it_value.tv_sec = SECONDS;
-    timer.it_value.tv_usec = MICSECONDS;
+    // O produtor não pode ser escalonado antes de ser suspenso
+    beginDeferral();
+    err = createFiber(&producerId, generatorMain, newGen, &spec);
+    if(err == 0){
+        newGen->producer = findFiber(producerId);
+        newGen->producer->cold->generator = newGen;
+        newGen->producer->status = SUSPENDED;
+        newGen->producer->readySince = 0; // Só executa quando retomado pelo consumidor
+    }
+    endDeferral();
 
-    // Resetando o timer
-    restoreTimer(&timer);
+    if(err != 0){
+        free(newGen);
+        return err;
+    }
 
-    // Definindo o contexto atual como o da próxima fiber
-	if(setcontext(&nextFiber->context) == -1){
-    	perror("Ocorreu um erro no setcontext da fiberScheduler");
-    	return;
+    *gen = newGen;
+    return 0;
+}
+
+/*
+    generator_next
+    --------------
+
+    Passa a CPU diretamente para o produtor do generator, até que ele
+    produza o próximo valor, que é transferido para *value(caso value
+    não seja NULL). Retorna ERR_DONE caso o produtor já tenha terminado
+    ou termine sem produzir um valor.
+
+*/
+int generator_next(generator_t *gen, void **value){
+    if(gen == NULL)
+        return ERR_NULLID;
+    if(gen->done)
+        return ERR_DONE;
+
+    Fiber * current = runtime->f_list->currentFiber;
+    if(current == gen->producer)
+        return ERR_JOINCRRT;
+
+    // Suspendendo o consumidor e retomando o produtor
+    beginDeferral();
+    if(materializeFiber(gen->producer, NULL, 0) != 0){
+        endDeferral();
+        return ERR_MALL;
+    }
+    gen->consumer = current;
+    current->status = SUSPENDED;
+    gen->producer->status = READY;
+    if(yieldTo(current, gen->producer, TRACE_HANDOFF) == -1){
+        perror("Ocorreu um erro no swapcontext da generator_next");
+        current->status = READY;
+        endDeferral();
+        return ERR_SWPCTX;
+    }
+
+    if(gen->done)
+        return ERR_DONE;
+    if(value != NULL)
+        *value = gen->value;
+    return 0;
+}
+
+/*
+    fiber_yield_value
+    -----------------
+
+    Chamada pelo produtor de um generator: passa value para o consumidor
+    e devolve a CPU diretamente para ele. Retorna quando o consumidor 
+    pedir o próximo valor. Retorna ERR_NOTFOUND caso a fiber atual não
+    seja o produtor de um generator.
+
+*/
+int fiber_yield_value(void *value){
+    Fiber * current = runtime != NULL && runtime->f_list != NULL ? runtime->f_list->currentFiber : NULL;
+    if(current == NULL || current->cold->generator == NULL)
+        return ERR_NOTFOUND;
+
+    Generator * gen = current->cold->generator;
+
+    // Suspendendo o produtor e retomando o consumidor
+    beginDeferral();
+    gen->value = value;
+    current->status = SUSPENDED;
+    gen->consumer->status = READY;
+    if(yieldTo(current, gen->consumer, TRACE_HANDOFF) == -1){
+        perror("Ocorreu um erro no swapcontext da fiber_yield_value");
+        current->status = READY;
+        endDeferral();
+        return ERR_SWPCTX;
+    }
+
+    return 0;
+}
+
+/*
+    generator_destroy
+    -----------------
+
+    Libera o generator. Caso o produtor ainda não tenha terminado, ele
+    é encerrado sem voltar a executar(e destruído pelo escalonador). 
+    Retorna ERR_NOTREADY caso o produtor esteja executando, isto é, 
+    caso a generator_next() ainda não tenha retornado.
+
+*/
+int generator_destroy(generator_t *gen){
+    if(gen == NULL)
+        return ERR_NULLID;
+
+    if(!gen->done){
+        beginDeferral();
+        if(gen->producer->status != SUSPENDED){
+            endDeferral();
+            return ERR_NOTREADY;
+        }
+        gen->producer->cold->generator = NULL;
+        gen->producer->status = FINISHED;
+        endDeferral();
+    }
+
+    free(gen);
+    return 0;
+}
+
+/*
+    waitBucket
+    ----------
+
+    Retorna a lista de espera da tabela correspondente ao endereço addr.
+
+*/
+WaitBucket * waitBucket(int * addr){
+    uint64_t hash = ((uintptr_t) addr >> 2) * 0x9E3779B97F4A7C15ull;
+    return &runtime->waitTable[hash >> 56 & (WAIT_BUCKETS - 1)];
+}
+
+/*
+    pickReady
+    ---------
+
+    Escolha leve usada na troca da fiber_wait(): retorna a primeira 
+    fiber pronta e com a pilha já montada a partir da seguinte a current,
+    ou NULL caso não haja nenhuma. Ao contrário da pickNext(), não insere
+    as tarefas da fiber_post(), não repõe a reserva de pilhas, não monta
+    pilhas e não destrói fibers: nada é alocado nem liberado. Isso fica
+    para a próxima troca completa(uma preempção, por exemplo, já que a
+    fiber escolhida continua o timeslice de current).
+
+*/
+Fiber * pickReady(Fiber * current){
+    Fiber * fiber;
+
+    for(fiber = current->next; fiber != current; fiber = fiber->next)
+        if(fiber->status == READY && fiber->cold->context != NULL)
+            return fiber;
+    return NULL;
+}
+
+/*
+    fiber_wait
+    ----------
+
+    Caso *addr ainda seja igual a expected, para a fiber atual até que
+    outra fiber chame fiber_wake(addr, n). A comparação e a parada são
+    atômicas em relação às demais fibers. Caso *addr seja diferente de
+    expected, retorna ERR_AGAIN imediatamente.
+
+    O nodo de espera fica na pilha da fiber, e a preempção é apenas 
+    adiada durante a parada(o timer não é alterado): a CPU passa para
+    a próxima fiber pronta e já materializada(ver pickReady) no 
+    restante do timeslice desta.
+
+*/
+int fiber_wait(int *addr, int expected){
+    WaitNode node;
+
+    if(addr == NULL)
+        return ERR_NULLID;
+    if(runtime == NULL || runtime->f_list == NULL)
+        return ERR_NOTREADY;
+
+    beginDeferral();
+
+    if(*(volatile int *) addr != expected){
+        endDeferral();
+        return ERR_AGAIN;
+    }
+
+    Fiber * current = runtime->f_list->currentFiber;
+
+    // Inserindo a fiber no final da lista de espera do endereço
+    WaitBucket * bucket = waitBucket(addr);
+    node.addr = addr;
+    node.fiber = current;
+    node.next = NULL;
+    if(bucket->tail == NULL)
+        bucket->head = &node;
+    else
+        bucket->tail->next = &node;
+    bucket->tail = &node;
+
+    current->status = PARKED;
+
+    // Trocando diretamente para a próxima fiber. Como a atual está parada, ela 
+    // não é escolhida. Só quando nenhuma fiber pronta tem pilha a escolha 
+    // completa é feita, e a pickNext() dorme caso nenhuma outra possa executar
+    Fiber * next = pickReady(current);
+    if(next == NULL)
+        next = pickNext(current, 0);
+    if(yieldTo(current, next, TRACE_PARKED) == -1){
+        perror("Ocorreu um erro no swapcontext da fiber_wait");
+        endDeferral();
+        return ERR_SWPCTX;
     }
+
+    return 0;
 }
 
-/*  
-    startFibers
+/*
+    wakeAddress
     -----------
 
-    Função responsável por inicializar as estruturas do timer e 
-    sinalizador, e a cada SECONDS segundos e MICSECONDS microssegundos,
-    um sinal é enviado para o processo cujo tratador é o a rotina
-    timeHandler(), que chama o escalonador de fibers.
+    Implementação da fiber_wake(), chamada com a preempção adiada ou
+    com o timer parado. Também é usada pelo controle de admissão.
 
 */
-void startFibers() {
-    // Criando e inicializando a struct do sigaction
-    struct sigaction sa;
-    memset (&sa, 0, sizeof (sa));
+int wakeAddress(int * addr, int n){
+    WaitNode * node, * prev = NULL, * next;
+    int woken = 0;
+
+    WaitBucket * bucket = waitBucket(addr);
+    for(node = bucket->head; node != NULL && woken < n; node = next){
+        next = node->next;
+
+        // Endereço diferente com o mesmo hash
+        if(node->addr != addr){
+            prev = node;
+            continue;
+        }
 
-    // Atribuindo a rotina timeHandler() como tratador do sinal
-    sa.sa_handler = &timeHandler;
+        // Retirando o nodo da lista
+        if(prev == NULL)
+            bucket->head = next;
+        else
+            prev->next = next;
+        if(bucket->tail == node)
+            bucket->tail = prev;
 
-    // Chamada de sistema para configurar o tratador do sinal SIGVTALRM no processo
-    if(sigaction (SIGVTALRM, &sa, NULL) == -1){
-    	perror("Ocorreu um erro no sigaction da startFibers");
-    	return;
+        markReady(node->fiber, 0);
+        woken++;
     }
-    
-    // Inicializando o timer e seus intervalos
-    timer.it_value.tv_sec = SECONDS;
-    timer.it_value.tv_usec = MICSECONDS;
- 
-    timer.it_interval.tv_sec = SECONDS;
-    timer.it_interval.tv_usec = MICSECONDS;
 
-    // Começando o timer
-    restoreTimer(&timer);
+    return woken;
 }
 
 /*
-    initFiberList
-    -------------
+    fiber_wake
+    ----------
 
-    Função responsável por inicializar a lista de fibers caso ela não tenha
-    sido inicializada ainda.
+    Acorda até n fibers paradas na fiber_wait() no endereço addr, na 
+    ordem em que pararam. As fibers acordadas ficam prontas e executam
+    na sua vez. Retorna a quantidade de fibers acordadas.
 
-    Ela também insere a estrutura da thread principal como a cabeça da lista,
-    e cria o contexto para a função FiberScheduler.
 */
-int initFiberList() {
-    
-    // Criando a estrutura da lista
-    f_list = (FiberList *) malloc(sizeof(FiberList));
-    if (f_list == NULL) {
-        perror("erro malloc na criação da lista na initFiberList");
-        return ERR_MALL;
-    }
-    // Inicializando a lista de fibers
-    f_list->fibers = NULL;
-    f_list->nFibers = 0;
-    f_list->currentFiber = NULL;
-    f_list->started = 0;
-    
-    // Criando a estrutura de fiber para a thread principal
-    Fiber * parentFiber = (Fiber *) malloc(sizeof(Fiber));
-    if (parentFiber == NULL) {
-        perror("erro malloc na criação da parentFiber da initFiberList");
-        return ERR_MALL;
-    }
+int fiber_wake(int *addr, int n){
+    if(addr == NULL || runtime == NULL || runtime->f_list == NULL)
+        return 0;
 
-    // Inicializando a estrutura da thread principal
-    parentFiber->context = parentContext;
-    parentFiber->fiberId = PARENT_ID;
-    parentFiber->prev = NULL;
-    parentFiber->next = NULL; 
-    parentFiber->status = READY;
+    beginDeferral();
+    int woken = wakeAddress(addr, n);
+    endDeferral();
 
-    // Adicionado a estrutura da thread principal como o primeiro elemento da lista
-    f_list->fibers = (Fiber *) parentFiber;
+    return woken;
+}
 
-    // Incrementando o número de fibers da lista
-    f_list->nFibers++;
+/*
+    fiber_metrics_start
+    -------------------
 
-    // Definindo a thread principal como fiber atual
-    f_list->currentFiber = (Fiber *) parentFiber;
+    Cria o segmento de memória compartilhada name(shm_open, por exemplo
+    "/fiberlib") com uma página FiberMetrics, na qual o escalonador 
+    passa a publicar os contadores do runtime da thread atual a cada
+    METRICS_INTERVAL. Caso name seja NULL, o nome "/fiberlib.<tid>" é
+    usado(o tid da thread principal é o pid do processo).
 
-    // Obtendo um contexto para o escalonador
-    if(getcontext(&schedulerContext) == -1){
-    	perror("Ocorreu um erro no getcontext da initFiberList");
-    	return ERR_GTCTX;
-    }
-    
-    // Limpando o contexto recebido para o escalonador
-    schedulerContext.uc_link = &parentContext;
-    schedulerContext.uc_stack.ss_sp = malloc(FIBER_STACK);
-    schedulerContext.uc_stack.ss_size = FIBER_STACK;
-    schedulerContext.uc_stack.ss_flags = 0;        
-    if (schedulerContext.uc_stack.ss_sp == NULL) {
-        perror("erro malloc na criação da pilha na initFiberList");
+*/
+int fiber_metrics_start(const char *name){
+    char defaultName[64];
+
+    if(getRuntime() == NULL)
         return ERR_MALL;
+    if(runtime->metrics.page != NULL)
+        return ERR_EXISTS;
+
+    if(name == NULL){
+        snprintf(defaultName, sizeof(defaultName), "/fiberlib.%d", (int) gettid());
+        name = defaultName;
     }
+    if(strlen(name) >= sizeof(runtime->metrics.name))
+        return ERR_SIZE;
 
-    // Criando o contexto do escalonador 
-    makecontext(&schedulerContext, fiberScheduler, 1, NULL);
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if(fd == -1){
+        perror("Ocorreu um erro no shm_open da fiber_metrics_start");
+        return ERR_IO;
+    }
+    if(ftruncate(fd, sizeof(FiberMetrics)) == -1){
+        perror("Ocorreu um erro no ftruncate da fiber_metrics_start");
+        close(fd);
+        shm_unlink(name);
+        return ERR_IO;
+    }
 
-	return 0;
+    FiberMetrics * page = (FiberMetrics *) mmap(NULL, sizeof(FiberMetrics), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(page == MAP_FAILED){
+        perror("Ocorreu um erro no mmap da fiber_metrics_start");
+        shm_unlink(name);
+        return ERR_IO;
+    }
+
+    memset(page, 0, sizeof(FiberMetrics));
+    memcpy(page->magic, METRICS_MAGIC, sizeof(page->magic));
+    page->pid = (uint64_t) getpid();
+
+    strcpy(runtime->metrics.name, name);
+    runtime->metrics.lastPublish = monotonicNs();
+    runtime->metrics.lastSwitches = runtime->metrics.switches;
+    runtime->metrics.page = page;
+
+    // Os leitores já encontram os contadores atuais, sem esperar pela primeira passada
+    publishMetrics(1);
+
+    return 0;
 }
 
 /*
-    pushFiber
-    ---------
+    fiber_metrics_stop
+    ------------------
 
-    Insere a fiber recebida pela função na lista de fibers. Caso a 
-    lista ainda não tenha sido criada, a função initFiberList() é 
-    chamada. Durante a inserção da fiber, o timeslice restante da 
-    fiber atual é salvo e o timer é pausado. Depois que a inserção
-    é feita, o timer é reiniciado com o timeslice salvo anteriormente.
+    Para a publicação das métricas e remove o segmento compartilhado.
+    Também é chamada pelo escalonador quando todas as fibers terminam.
+    Antes disso, publica os contadores finais e marca a página como
+    parada, para os leitores que ainda a têm mapeada.
 
 */
-void pushFiber(Fiber * fiber) {
-    
-    struct itimerval restored;
-
-    // Iniciando a lista de fibers, caso seja null
-    if(f_list == NULL)
-        initFiberList();
+void fiber_metrics_stop(){
+    if(runtime == NULL || runtime->metrics.page == NULL)
+        return;
 
-    // Para o timer para evitar troca de fibers em região crítica
-    stopTimer(&restored);
-    // Caso só haja a fiber da thread principal na lista
-    if (f_list->nFibers == 1) {
-        fiber->prev = (Fiber *) f_list->fibers;
-        fiber->next = f_list->fibers;
-        f_list->fibers->prev = (Fiber *) fiber; 
-        f_list->fibers->next = (Fiber *) fiber;
-        
-    } 
-    else { // Caso haja outras fibers na lista
-        fiber->next = (Fiber *) f_list->fibers;
-        fiber->prev = (Fiber *) f_list->fibers->prev;
-        fiber->prev->next = (Fiber *) fiber;
-        f_list->fibers->prev = (Fiber *) fiber;
-    }
+    FiberMetrics * page = runtime->metrics.page;
 
-	// Incrementando o número de fibers
-    f_list->nFibers++;
+    publishMetrics(1);
+    __atomic_store_n(&page->stopped, 1, __ATOMIC_RELEASE);
 
-    // Definindo o id da fiber
-    fiber->fiberId = f_list->nFibers - 1;
-	
-    // restaura o timer para o restante do timeslice que a fiber atual possuía
-    restoreTimer(&restored);
-    
+    runtime->metrics.page = NULL;
+    munmap(page, sizeof(FiberMetrics));
+    shm_unlink(runtime->metrics.name);
 }
 
 /*
-    fiber_create
-    ------------
+    fiber_latency_start
+    -------------------
 
-    Cria uma fiber(user-level thread) que executará a rotina(função)
-    start_routine, recebendo o parâmetro arg. Caso a fiber seja criada
-    corretamente, ela será inserida na lista de fibers, e seu id será
-    transferido para o endereço apontado por *fiber.
+    Liga os histogramas de latência do runtime da thread atual. Enquanto
+    eles estão desligados, o escalonador não lê o relógio nas trocas de
+    fiber. As fibers que já estão prontas começam a esperar a CPU agora.
+    Retorna ERR_EXISTS caso as medidas já estejam ligadas.
 
 */
-int fiber_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg) {
-    // Variável que irá armazenar o contexto da nova fiber
-    ucontext_t fiberContext;
-
-    // Struct que irá armazenar a nova fiber
-    Fiber * fiberNode;
+int fiber_latency_start(){
+    int i;
 
-    // Se o ponteiro apontar para NULL
-    if(fiber == NULL)
-        return ERR_NULLID;
-    
-    // Verificando se já existe uma fiber com esse id
-    if(findFiber(* fiber) != NULL){
-        printf("Essa fiber já existe\n");
+    if(getRuntime() == NULL)
+        return ERR_MALL;
+    if(runtime->latency != NULL)
         return ERR_EXISTS;
-    }    
 
-    // Alocando memória para a estrutura da fiber
-    fiberNode = (Fiber *) malloc(sizeof(Fiber));
-
-    // Caso a alocação de memória falhe
-    if (fiberNode == NULL) {
-        perror("erro malloc na criação da fiber struct da fiber_create");
+    Histogram * latency = (Histogram *) calloc(LATENCY_HISTOGRAMS, sizeof(Histogram));
+    if(latency == NULL){
+        perror("erro malloc na criação dos histogramas da fiber_latency_start");
         return ERR_MALL;
     }
-    
-    // Obtendo o contexto atual e armazenando-o na variável fiberContext
-    if(getcontext(&fiberContext) == -1){
-    	perror("Ocorreu um erro no getcontext da fiber_create");
-    	return ERR_GTCTX;
+
+    beginDeferral();
+    uint64_t now = monotonicNs();
+    int nFibers = runtime->f_list != NULL ? runtime->f_list->nFibers : 0;
+    Fiber * fiber = nFibers > 0 ? runtime->f_list->fibers : NULL;
+    for(i = 0; i < nFibers; i++, fiber = fiber->next){
+        fiber->readySince = fiber->status == READY && fiber != runtime->f_list->currentFiber ? now : 0;
+        fiber->joinWoken = 0;
     }
+    runtime->sliceStart = now;
+    runtime->latency = latency;
+    endDeferral();
+
+    return 0;
+}
 
-    // Modificando o contexto para uma nova pilha
-    fiberContext.uc_link = &schedulerContext;
-    fiberContext.uc_stack.ss_sp = malloc(FIBER_STACK);
-    fiberContext.uc_stack.ss_size = FIBER_STACK;
-    fiberContext.uc_stack.ss_flags = 0;
+/*
+    fiber_latency_stop
+    ------------------
 
-    // Caso a alocação da pilha falhe        
-    if (fiberContext.uc_stack.ss_sp == 0 ) {
-        perror("erro malloc na criação da pilha na fiber_create");
-        return ERR_MALL;
-    }
+    Desliga os histogramas de latência do runtime da thread atual e
+    descarta as medidas.
 
-    // Criando a fiber propriamente dita
-    makecontext(&fiberContext, (void (*)(void )) start_routine, 1, arg);
+*/
+void fiber_latency_stop(){
+    if(runtime == NULL || runtime->latency == NULL)
+        return;
 
-    // Inicializando a struct recém-criada que armazena a fiber 
-    fiberNode->context = fiberContext;
-    fiberNode->prev = NULL;
-    fiberNode->next = NULL;
-    fiberNode->status = READY;
-    fiberNode->retval = NULL;
-    fiberNode->join_retval = NULL;
-    fiberNode->joinFiber = NULL;
-    fiberNode->waitingList = NULL;
+    beginDeferral();
+    Histogram * latency = runtime->latency;
+    runtime->latency = NULL;
+    endDeferral();
 
-    // Inserindo a nova fiber na lista de fibers
-    pushFiber(fiberNode);
+    free(latency);
+}
 
-    // Atribuindo o id da fiber adequadamente
-    * fiber = fiberNode->fiberId;
+/*
+    latencyPercentile
+    -----------------
 
-    // Verificando se o escalonador já começou a rodar.
-    // Caso não tenha, startFibers() é chamada e o contexto
-    // da thread principal é capturado.
-    if (f_list->started == 0) {
-        f_list->started = 1;
-        startFibers();
+    Retorna o percentil percentile(entre 0 e 100) do histograma hist: o
+    maior valor do bucket que contém a medida daquela posição, limitado
+    à maior medida registrada. Retorna 0 caso o histograma esteja vazio.
 
-        // Obtendo o contexto da thread atual e o transferindo para o currentContext
-        if(getcontext(&f_list->fibers->context) == -1){
-            perror("Ocorreu um erro no getcontext da fiber_create");
-            return ERR_GTCTX;
-        }
+*/
+uint64_t latencyPercentile(const Histogram * hist, double percentile){
+    uint64_t rank, seen = 0, upper;
+    int bucket;
+
+    if(hist->total == 0)
+        return 0;
+
+    // Posição da medida procurada(arredondada para cima, a partir de 1)
+    double target = percentile / 100.0 * (double) hist->total;
+    rank = (uint64_t) target;
+    if((double) rank < target || rank == 0)
+        rank++;
+
+    for(bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++){
+        seen += hist->counts[bucket];
+        if(seen >= rank)
+            break;
     }
 
-    return 0;
+    // Maior valor do bucket(ver latencyBucket)
+    if(bucket < LATENCY_SUB)
+        upper = (uint64_t) bucket;
+    else{
+        int shift = bucket / LATENCY_SUB - 1;
+        uint64_t sub = (uint64_t) (bucket % LATENCY_SUB + LATENCY_SUB);
+        upper = ((sub + 1) << shift) - 1;
+    }
+
+    return upper < hist->max ? upper : hist->max;
 }
 
 /*
-    fiber_join
-    ----------
-
-    Faz com que a fiber atual espere o término de outra fiber para começar a executar.
-    Caso o ponteiro recebido por retval não seja NULL, a função transferirá o endereço
-    de memória do valor de retorno da fiber que estava sendo aguardada para ele, para que
-    este possa permitir que o usuário da biblioteca recupere esse valor de retorno e o use.
+    fiber_latency_percentile
+    ------------------------
 
-    A alocação de memória necessária para o ponteiro duplo(void ** retval) é de total
-    responsabilidade do usuário da biblioteca.
+    Obtém o percentil percentile(entre 0 e 100) do histograma de latência
+    histogram(FIBER_LATENCY_READY, FIBER_LATENCY_JOIN ou FIBER_LATENCY_SLICE)
+    do runtime da thread atual, em nanossegundos. Caso o histograma não
+    tenha nenhuma medida, *ns recebe 0. Retorna ERR_NOTFOUND caso as
+    medidas estejam desligadas.
 
 */
-int fiber_join(fiber_t fiber, void **retval){
+int fiber_latency_percentile(int histogram, double percentile, uint64_t *ns){
+    if(ns == NULL)
+        return ERR_NULLID;
+    if(runtime == NULL || runtime->latency == NULL || histogram < 0 || histogram >= LATENCY_HISTOGRAMS)
+        return ERR_NOTFOUND;
+    if(!(percentile >= 0.0 && percentile <= 100.0))
+        return ERR_SIZE;
 
-    // Tentando encontrar a fiber com o id fiber
-    Fiber * fiberNode = findFiber(fiber);
+    // O tratador do timer também registra medidas
+    beginDeferral();
+    *ns = latencyPercentile(&runtime->latency[histogram], percentile);
+    endDeferral();
 
-    // Se a fiber não foi encontrada na lista
-    if(fiberNode == NULL)
+    return 0;
+}
+
+/*
+    fiber_latency_stats
+    -------------------
+
+    Preenche stats com a quantidade de medidas, os percentis 50, 99 e
+    99,9 e a maior medida do histograma de latência histogram do runtime
+    da thread atual. Retorna ERR_NOTFOUND caso as medidas estejam 
+    desligadas.
+
+*/
+int fiber_latency_stats(int histogram, FiberLatency *stats){
+    if(stats == NULL)
+        return ERR_NULLID;
+    if(runtime == NULL || runtime->latency == NULL || histogram < 0 || histogram >= LATENCY_HISTOGRAMS)
         return ERR_NOTFOUND;
 
-    // Se a fiber a ser esperada é a que está executando
-    if(fiberNode->fiberId == f_list->currentFiber->fiberId)
-        return ERR_JOINCRRT;
+    beginDeferral();
+    Histogram * hist = &runtime->latency[histogram];
+    stats->count = hist->total;
+    stats->p50 = latencyPercentile(hist, 50.0);
+    stats->p99 = latencyPercentile(hist, 99.0);
+    stats->p999 = latencyPercentile(hist, 99.9);
+    stats->max = hist->max;
+    endDeferral();
 
-    // Se a fiber que deveria terminar antes já terminou
-    if(fiberNode->status == FINISHED){
-        releaseFibers(fiberNode->waitingList);
-        return 0;
-    } 
-        
+    return 0;
+}
 
-	// Criando um nodo para a lista de espera da fiber que será aguardada
-    Waiting * waitingNode = (Waiting *) malloc(sizeof(Waiting));
+/*
+    fiber_latency_reset
+    -------------------
 
-    // Caso a alocação falhe
-    if (waitingNode == NULL) {
-        perror("erro malloc na fiber_join");
-        return ERR_MALL;
-    }
+    Zera os histogramas de latência do runtime da thread atual, para
+    que as próximas consultas cubram apenas o intervalo seguinte.
 
-    // Atribuindo o id do nodo e inicializando seu ponteiro next
-    waitingNode->waitingId = fiber;
-    waitingNode->next = NULL;
+*/
+void fiber_latency_reset(){
+    if(runtime == NULL || runtime->latency == NULL)
+        return;
 
-    // Parar o timer, área crítica
-    stopTimer(NULL);
+    beginDeferral();
+    memset(runtime->latency, 0, LATENCY_HISTOGRAMS * sizeof(Histogram));
+    endDeferral();
+}
 
-    // Adicionando um nodo na lista de espera da fiber a ser aguardada
-    if(fiberNode->waitingList == NULL){
-        fiberNode->waitingList = (Waiting *) waitingNode;     
-    }  
-    else{
-        Waiting * waitingTop = (Waiting *) fiberNode->waitingList;
-        fiberNode->waitingList = (Waiting *) waitingNode;
-        fiberNode->waitingList->next = (Waiting *) waitingTop;
-    }
+/*
+    fiber_set_limits
+    ----------------
 
-    // Definindo a fiber que a fiber atual está esperando
-    f_list->currentFiber->joinFiber = (Fiber *) fiberNode;
+    Define os limites do controle de admissão do runtime da thread 
+    atual: no máximo maxFibers fibers vivas(criadas e ainda não 
+    destruídas) e no máximo maxStackBytes bytes de pilha reservados, 
+    contando FIBER_STACK bytes por fiber viva. Zero desativa o limite
+    correspondente. Fibers já criadas não são afetadas, mas contam 
+    para os limites.
 
-    // Marcando a fiber atual como esperando
-    f_list->currentFiber->status = WAITING;  
+    Depois de atingido um limite, a fiber_create() e suas variações 
+    param a fiber atual até que alguma fiber seja destruída, e a 
+    fiber_try_create() retorna ERR_BUSY.
 
-    // Trocando para o contexto do escalonador
-    if(swapcontext(&f_list->currentFiber->context, &schedulerContext) == -1){
-    	perror("Ocorreu um erro no swapcontext da fiber_join");
-    	return ERR_SWPCTX;
-    }
+*/
+int fiber_set_limits(int maxFibers, size_t maxStackBytes){
+    if(maxFibers < 0 || (maxStackBytes != 0 && maxStackBytes < FIBER_STACK))
+        return ERR_SIZE;
+    if(getRuntime() == NULL)
+        return ERR_MALL;
 
-    // Recuperando o valor de retorno da fiber que estava sendo aguardada.
-	// Caso NULL tenha sido passado como argumento para retval, nada mais é feito.
-    // Caso a fiber que estava sendo aguardada por esta tenha sido destruída,
-    // as rotinas de destruição já distribuíram os valores de retval corretamente
-    // para os atributos join_retval das fibers que estavam aguardando-a.
-	if(retval != NULL){
-        // Caso a joinFiber não tenha sido destruída ainda, o retval é recuperado diretamente dela
-		if(f_list->currentFiber->join_retval == NULL && f_list->currentFiber->joinFiber != NULL)
-			*retval = f_list->currentFiber->joinFiber->retval;
-        // Caso contrário, o retval é recuperado do atributo join_retval da própria fiber que chamou
-        // fiber_join()
-		else 
-			*retval = f_list->currentFiber->join_retval;
-		
-		// Resetando os retvals da fiber
-		f_list->currentFiber->retval = NULL;
-		f_list->currentFiber->join_retval = NULL;
-	}
+    struct itimerspec restored;
 
-    // Definindo o status da fiber atual como pronta para executar
-    f_list->currentFiber->status = READY;
+    stopTimer(&restored);
+    runtime->admission.maxFibers = maxFibers;
+    runtime->admission.maxStackBytes = maxStackBytes;
+
+    // Limites maiores podem liberar criações que estavam esperando
+    if(runtime->admission.waiting > 0){
+        runtime->admission.released++;
+        wakeAddress(&runtime->admission.released, runtime->admission.waiting);
+    }
+    restoreTimer(&restored);
 
     return 0;
 }
 
 /*
-    fiber_exit
-    ----------
+    fiber_try_create
+    ----------------
 
-    Para a execução da fiber atual e altera seu status para FINISHED.
-    Com seu status FINISHED, essa fiber nunca mais será executada, e
-    ao ser identificada pelo escalonador, terá sua área de memória
-    liberada, após ter corretamente transferido o endereço de memória
-    de retval para as fibers que a estavam esperando e as liberado para
-    serem executadas pelo escalonador, caso existam.
-
-    A alocação de memória necessária para o ponteiro retval é de total
-    responsabilidade do usuário da biblioteca, e caso um valor nulo 
-    seja recebido em seu lugar, esse valor será simplesmente ignorado
-    pelas rotinas que fazem uso dele.
+    Igual à fiber_create(), mas caso os limites do controle de admissão
+    estejam atingidos, retorna ERR_BUSY imediatamente ao invés de 
+    esperar uma vaga.
 
 */
-void fiber_exit(void *retval){
+int fiber_try_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg){
+    FiberSpec spec = { .nonBlocking = 1 };
 
-    // Instanciando o valor de retorno da fiber
-    f_list->currentFiber->retval = retval;
-    // Definindo status da fiber atual como terminada
-    f_list->currentFiber->status = FINISHED;
-
-    // Chamando o escalonador corretamente
-    timeHandler();
+    return createFiber(fiber, start_routine, arg, &spec);
 }
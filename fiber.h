@@ -20,6 +20,16 @@
     Implementação de threads em user-level(fibers) no modelo M para 1(M threads user-level para 1 
     thread kernel-level) com escalonamento preemptivo utilizando o algoritmo round-robin.
 
+    Cada thread kernel-level que cria fibers tem o seu próprio escalonador, independente dos
+    demais: as fibers de uma thread só executam nela, e só podem ser aguardadas, acordadas ou
+    trocadas por fibers da mesma thread. Assim, um serviço pode executar um escalonador por 
+    núcleo. Quando todas as fibers de uma thread que não é a principal terminam, a thread
+    também termina. Uma thread também pode simplesmente retornar: o seu escalonador, suas
+    threads auxiliares da fiber_offload() e as fibers que ainda não terminaram são destruídos
+    junto com ela.
+
+    Com glibc anteriores à 2.34, o programa deve ser ligado com -lrt(timer_create e shm_open).
+
     A alocação de memória para ponteiros que guardam e recebem valores de retorno de fibers é de 
     TOTAL RESPONSABILIDADE DOS USUÁRIOS DA BIBLIOTECA. Além disso, as rotinas aqui implementadas
     NÃO EVITAM que recursos possam ser acessados por múltiplas fibers ao mesmo tempo, nem mesmo 
@@ -28,8 +38,20 @@
     by Guilherme Bartasson, Diego Batistuta e Vitor Teixeira, 2019
 */
 
+#ifndef FIBER_H
+#define FIBER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef int fiber_t; // tipo para ID de fibers
 
+typedef struct Generator generator_t; // tipo opaco dos generators
+
 // Erros das funções
 #define ERR_EXISTS   11
 #define ERR_MALL     22
@@ -38,6 +60,196 @@ typedef int fiber_t; // tipo para ID de fibers
 #define ERR_NOTFOUND 55
 #define ERR_JOINCRRT 66
 #define ERR_NULLID   77
+#define ERR_IO       88
+#define ERR_SIZE     99
+#define ERR_NOTREADY 110
+#define ERR_DONE     121
+#define ERR_AGAIN    132
+#define ERR_BUSY     143
+
+// Pilha de 64kB, reservada para cada fiber viva pelo controle de admissão
+#define FIBER_STACK 1024*64
+
+// Tamanho máximo de um valor de retorno passado por valor(fiber_exit_value)
+#define FIBER_INLINE_RETVAL 16
+
+// Alinhamento dos blocos retornados pela fiber_alloc
+#define ARENA_ALIGN 16
+
+// Alinhamento da área reservada no topo da pilha pela fiber_create_closure
+#define CLOSURE_ALIGN 16
+
+// Tipos de eventos do tracer
+#define TRACE_CREATE     1
+#define TRACE_SWITCH_IN  2
+#define TRACE_SWITCH_OUT 3
+#define TRACE_EXIT       4
+#define TRACE_JOIN_BLOCK 5
+#define TRACE_WAKE       6
+
+// Motivos de um evento TRACE_SWITCH_OUT
+#define TRACE_PREEMPTED 1
+#define TRACE_JOINED    2
+#define TRACE_EXITED    3
+#define TRACE_OFFLOADED 4
+#define TRACE_HANDOFF   5
+#define TRACE_PARKED    6
+
+// Identificador dos arquivos gerados pela fiber_trace_dump
+#define TRACE_MAGIC "FIBTRACE"
+
+// Identificador da página publicada pela fiber_metrics_start
+#define METRICS_MAGIC "FIBMETRC"
+
+// Histogramas de latência do escalonador
+#define FIBER_LATENCY_READY 0 // De pronta até executar
+#define FIBER_LATENCY_JOIN  1 // Do término da fiber aguardada até o retorno do join
+#define FIBER_LATENCY_SLICE 2 // Tempo de relógio(não de CPU) de cada fatia de execução
+
+/*
+    TraceEvent
+    ----------
+
+    Struct de tamanho fixo(16 bytes) de um evento de escalonamento
+    registrado pelo tracer.
+    *************************************************************
+
+    Atributos:
+    +++++++++
+
+    - timestamp: instante do evento, em ticks do rdtsc(x86) ou em
+      nanossegundos do CLOCK_MONOTONIC(outras arquiteturas). A
+      conversão para nanossegundos é feita com os valores de 
+      calibração da TraceHeader.
+
+    - fiberId: id da fiber a que o evento se refere.
+
+    - type: tipo do evento(TRACE_CREATE, TRACE_SWITCH_IN, ...).
+
+    - reason: motivo de um TRACE_SWITCH_OUT(TRACE_PREEMPTED,
+      TRACE_JOINED, TRACE_EXITED, TRACE_OFFLOADED, TRACE_HANDOFF
+      ou TRACE_PARKED). Zero para os demais eventos.
+*/
+typedef struct TraceEvent{
+    uint64_t timestamp;       // Instante do evento
+    int32_t fiberId;          // Fiber do evento
+    uint16_t type;            // Tipo do evento
+    uint16_t reason;          // Motivo da troca de contexto
+}TraceEvent;
+
+/*
+    TraceHeader
+    -----------
+
+    Cabeçalho dos arquivos gerados pela fiber_trace_dump(), seguido
+    por nEvents structs TraceEvent, da mais antiga para a mais nova.
+    ***************************************************************
+
+    Atributos:
+    +++++++++
+
+    - magic: TRACE_MAGIC, sem o '\0'.
+
+    - nEvents: quantidade de eventos no arquivo.
+
+    - lost: quantidade de eventos sobrescritos no buffer circular
+      antes de serem salvos.
+
+    - ticksStart, nsStart, ticksEnd e nsEnd: pares de leituras do
+      relógio do tracer e do CLOCK_MONOTONIC feitas no início do 
+      trace e na sua gravação, usados para converter os timestamps
+      para nanossegundos.
+*/
+typedef struct TraceHeader{
+    char magic[8];            // Identificador do arquivo
+    uint64_t nEvents;         // Quantidade de eventos
+    uint64_t lost;            // Eventos perdidos
+    uint64_t ticksStart;      // Relógio do tracer no início
+    uint64_t nsStart;         // CLOCK_MONOTONIC no início
+    uint64_t ticksEnd;        // Relógio do tracer na gravação
+    uint64_t nsEnd;           // CLOCK_MONOTONIC na gravação
+}TraceHeader;
+
+/*
+    FiberMetrics
+    ------------
+
+    Página de métricas publicada pela fiber_metrics_start() em um 
+    segmento de memória compartilhada(/dev/shm), para ser lida por 
+    outros processos(como o fibertop).
+    **************************************************************
+
+    Atributos:
+    +++++++++
+
+    - magic: METRICS_MAGIC, sem o '\0'.
+
+    - seq: contador do seqlock. É ímpar enquanto a página está sendo
+      escrita: o leitor deve copiar a página entre duas leituras iguais
+      e pares de seq.
+
+    - pid: processo que publica a página.
+
+    - timestamp: CLOCK_MONOTONIC da última publicação, em nanossegundos.
+
+    - liveFibers: fibers na lista, incluindo a thread principal.
+
+    - readyFibers: fibers prontas para executar(tamanho da fila de prontas).
+
+    - joinWaiting: fibers esperando outras em um join.
+
+    - switches: trocas de fiber desde o início.
+
+    - switchesPerSec: trocas por segundo desde a publicação anterior.
+
+    - preemptions: fibers interrompidas pelo timer desde o início.
+
+    - stackBytes: bytes de pilha alocados para as fibers e o escalonador.
+
+    - stopped: diferente de zero depois que a publicação terminou(pela 
+      fiber_metrics_stop() ou pelo fim das fibers): os contadores são os
+      finais, e a página não será mais atualizada.
+*/
+typedef struct FiberMetrics{
+    char magic[8];            // Identificador da página
+    uint64_t seq;             // Contador do seqlock
+    uint64_t pid;             // Processo publicador
+    uint64_t timestamp;       // Instante da publicação
+    uint64_t liveFibers;      // Fibers existentes
+    uint64_t readyFibers;     // Fibers prontas
+    uint64_t joinWaiting;     // Fibers em join
+    uint64_t switches;        // Trocas de fiber
+    uint64_t switchesPerSec;  // Trocas por segundo
+    uint64_t preemptions;     // Preempções pelo timer
+    uint64_t stackBytes;      // Bytes de pilha em uso
+    uint64_t stopped;         // Publicação terminada
+}FiberMetrics;
+
+/*
+    FiberLatency
+    ------------
+
+    Resumo de um histograma de latência do escalonador, obtido pela
+    fiber_latency_stats(). Os percentis têm erro relativo de no 
+    máximo 1/16(6,25%), e nunca são maiores que max.
+    **************************************************************
+
+    Atributos:
+    +++++++++
+
+    - count: quantidade de medidas desde o último reset.
+
+    - p50, p99 e p999: percentis 50, 99 e 99,9, em nanossegundos.
+
+    - max: maior medida desde o último reset, em nanossegundos.
+*/
+typedef struct FiberLatency{
+    uint64_t count;           // Quantidade de medidas
+    uint64_t p50;             // Mediana
+    uint64_t p99;             // Percentil 99
+    uint64_t p999;            // Percentil 99,9
+    uint64_t max;             // Maior medida
+}FiberLatency;
 
 /*
     fiber_create
@@ -48,9 +260,75 @@ typedef int fiber_t; // tipo para ID de fibers
     corretamente, ela será inserida na lista de fibers, e seu id será
     transferido para o endereço apontado por *fiber.
 
+    Caso start_routine retorne, a fiber termina como se tivesse chamado
+    fiber_exit() com o valor retornado.
+
+    A pilha da fiber só é alocada quando ela executa pela primeira
+    vez: criar fibers que nunca chegam a executar custa apenas o seu
+    cabeçalho.
+    Caso a pilha não possa ser alocada nesse momento, a fiber termina
+    sem executar, e a fiber_join() nela retorna ERR_MALL.
+
+    Caso os limites definidos pela fiber_set_limits() estejam atingidos,
+    a fiber atual para até que alguma fiber seja destruída.
+
 */
 int fiber_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg);
 
+/*
+    fiber_create_arena
+    ------------------
+
+    Igual à fiber_create(), mas a fiber criada recebe uma arena com 
+    blocos de arenaSize bytes, da qual ela pode alocar memória com 
+    fiber_alloc(). Toda a memória da arena é liberada de uma só vez 
+    quando a fiber é destruída, após ter terminado.
+
+*/
+int fiber_create_arena(fiber_t *fiber, void *(*start_routine) (void *), void *arg, size_t arenaSize);
+
+/*
+    fiber_alloc
+    -----------
+
+    Aloca size bytes(alinhados a ARENA_ALIGN bytes) da arena da fiber 
+    atual, apenas incrementando um ponteiro. Quando o bloco atual da
+    arena se esgota, um novo bloco é obtido. A memória não deve ser 
+    liberada com free(): ela é liberada junto com a arena, quando a 
+    fiber é destruída. Por isso, ela também não deve ser usada como 
+    retval da fiber(fiber_exit_value() pode ser usada para isso).
+
+    Retorna NULL caso a fiber atual não tenha arena ou a alocação falhe.
+
+*/
+void * fiber_alloc(size_t size);
+
+/*
+    fiber_create_closure
+    --------------------
+
+    Igual à fiber_create(), mas ao invés de receber um argumento pronto,
+    reserva size bytes(alinhados a CLOSURE_ALIGN) no topo da pilha da 
+    nova fiber e chama init(area, ctx) para que eles sejam preenchidos
+    antes que a fiber possa executar. O endereço da área é passado 
+    para start_routine como argumento. Assim, o estado da rotina(uma
+    closure, por exemplo) é guardado sem nenhuma alocação extra.
+
+    Caso dispose não seja NULL, a fiber é criada como joinable: depois
+    de terminada, ela é mantida na lista até que alguma fiber dê join
+    nela ou ela seja desanexada com fiber_detach(). Caso ela seja 
+    destruída sem que seu retval tenha sido recebido por um join, 
+    dispose(retval) é chamada. A destruição é sempre feita por uma 
+    troca de contexto fora do tratador do sinal do escalonador(ou pela
+    destruição do runtime, quando a thread termina), nunca durante uma
+    preempção: dispose pode alocar e liberar memória.
+
+    size deve ser menor que metade do tamanho da pilha.
+
+*/
+int fiber_create_closure(fiber_t *fiber, void *(*start_routine) (void *), size_t size,
+                         void (*init)(void *storage, void *ctx), void *ctx, void (*dispose)(void *retval));
+
 /*
     fiber_join
     ----------
@@ -63,9 +341,39 @@ int fiber_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg);
     A alocação de memória necessária para o ponteiro duplo(void ** retval) é de total
     responsabilidade do usuário da biblioteca.
 
+    Caso a fiber aguardada tenha terminado sem executar, por não ter sido possível
+    alocar sua pilha, retorna ERR_MALL(e *retval recebe NULL).
+
 */
 int fiber_join(fiber_t fiber, void **retval);
 
+/*
+    fiber_join_value
+    ----------------
+
+    Igual à fiber_join(), mas, ao invés de um ponteiro, copia para value
+    os size primeiros bytes do valor de retorno que a fiber aguardada 
+    passou por valor para a fiber_exit_value(). Nenhuma alocação é 
+    necessária, nem pela fiber aguardada, nem pela que a espera.
+    
+    O tamanho máximo é FIBER_INLINE_RETVAL bytes. Caso a fiber aguardada
+    tenha terminado com fiber_exit(), ou passado menos bytes, os bytes
+    restantes serão zero.
+
+*/
+int fiber_join_value(fiber_t fiber, void *value, size_t size);
+
+/*
+    fiber_detach
+    ------------
+
+    Desanexa a fiber com o id fiber: depois de terminada, ela será 
+    destruída pelo escalonador mesmo que nenhuma fiber dê join nela.
+    Só faz diferença para fibers criadas pela fiber_create_closure().
+
+*/
+int fiber_detach(fiber_t fiber);
+
 /*
     fiber_exit
     ----------
@@ -82,5 +390,364 @@ int fiber_join(fiber_t fiber, void **retval);
     seja recebido em seu lugar, esse valor será simplesmente ignorado
     pelas rotinas que fazem uso dele.
 
+    Caso alguma fiber esteja esperando esta, a CPU é passada diretamente
+    para ela, sem passar pelo escalonador.
+
 */
 void fiber_exit(void *retval);
+
+/*
+    fiber_exit_value
+    ----------------
+
+    Igual à fiber_exit(), mas o valor de retorno(de até FIBER_INLINE_RETVAL
+    bytes) é passado por valor: size bytes a partir de value são copiados 
+    para a estrutura da própria fiber e, de lá, para as fibers que a 
+    aguardam com fiber_join_value(). Nenhuma alocação é necessária, e 
+    value pode apontar para uma variável local.
+
+    Caso size seja maior que FIBER_INLINE_RETVAL, retorna ERR_SIZE e a 
+    fiber continua executando. Caso contrário, não retorna.
+
+*/
+int fiber_exit_value(const void *value, size_t size);
+
+/*
+    fiber_switch_to
+    ---------------
+
+    Passa a CPU diretamente da fiber atual para a fiber com o id fiber,
+    com uma única troca de contexto e sem passar pelo escalonador(útil
+    quando a fiber atual acabou de liberar trabalho para outra). A fiber
+    atual continua pronta e volta a executar na sua vez, e a fiber de 
+    destino recebe um timeslice completo.
+
+    Retorna ERR_NOTFOUND caso a fiber não exista, ERR_JOINCRRT caso ela
+    seja a própria fiber atual e ERR_NOTREADY caso ela não esteja pronta
+    para executar(esperando um join ou uma rotina da fiber_offload, ou
+    terminada).
+
+*/
+int fiber_switch_to(fiber_t fiber);
+
+/*
+    fiber_trace_start
+    -----------------
+
+    Liga o tracer de escalonamento da thread atual, pré-alocando um
+    buffer circular para capacity eventos(arredondado para a próxima
+    potência de 2).
+    A partir daí, criações, entradas e saídas(com o motivo), términos,
+    bloqueios em joins e liberações de fibers são registrados até que
+    fiber_trace_stop() seja chamada. Caso o tracer já esteja ligado, 
+    o buffer antigo é descartado.
+
+*/
+int fiber_trace_start(unsigned long capacity);
+
+/*
+    fiber_trace_dump
+    ----------------
+
+    Grava os eventos presentes no buffer do tracer no arquivo path, 
+    no formato binário descrito pela TraceHeader. O arquivo pode ser
+    convertido para o formato JSON do Chrome/Perfetto com o programa
+    fibertrace. O tracer continua ligado.
+
+*/
+int fiber_trace_dump(const char *path);
+
+/*
+    fiber_trace_stop
+    ----------------
+
+    Desliga o tracer e libera seu buffer. Eventos ainda não gravados
+    com fiber_trace_dump() são descartados.
+
+*/
+void fiber_trace_stop();
+
+/*
+    fiber_profile_start
+    -------------------
+
+    Liga o profiler por amostragem: hz vezes por segundo de CPU consumida
+    pelo processo, o sinal SIGPROF é recebido e a fiber em execução, sua
+    rotina e sua pilha de chamadas são gravadas em um buffer pré-alocado
+    com espaço para maxSamples amostras. O profiler é do processo: as
+    amostras de todas as threads com fibers vão para o mesmo buffer. Amostras de uma execução 
+    anterior do profiler são descartadas.
+
+    Retorna ERR_NULLID caso hz ou maxSamples sejam inválidos, ERR_MALL
+    caso o buffer não possa ser alocado e ERR_IO caso o tratador do 
+    sinal ou o timer não possam ser instalados(nesse caso, o buffer é
+    liberado e o profiler continua desligado).
+
+*/
+int fiber_profile_start(int hz, unsigned long maxSamples);
+
+/*
+    fiber_profile_stop
+    ------------------
+
+    Para o timer do profiler. As amostras coletadas continuam 
+    disponíveis para a fiber_profile_dump().
+
+*/
+void fiber_profile_stop();
+
+/*
+    fiber_profile_dump
+    ------------------
+
+    Grava as amostras coletadas no arquivo path, no formato "folded 
+    stacks" lido por ferramentas de flamegraph: uma linha por pilha
+    distinta, com os frames separados por ';' a partir da raiz, seguidos
+    pela quantidade de amostras. O primeiro frame é a fiber(fiber_<id>)
+    e o segundo é a rotina dela, de forma que as pilhas de cada fiber 
+    fiquem separadas mesmo que comecem no makecontext.
+
+*/
+int fiber_profile_dump(const char *path);
+
+/*
+    fiber_offload
+    -------------
+
+    Executa a rotina bloqueante routine(arg)(uma chamada como getaddrinfo()
+    ou fsync(), por exemplo) em uma das threads auxiliares, e retorna o 
+    valor retornado por ela. Enquanto isso, a fiber atual fica parada, 
+    com status OFFLOADED, e as demais fibers continuam executando.
+
+    Cada thread com fibers tem as suas threads auxiliares. A rotina 
+    executa fora da thread das fibers, e por isso não pode chamar 
+    nenhuma função da biblioteca. Caso as fibers ainda não 
+    estejam executando, ou as threads auxiliares não possam ser 
+    criadas, a rotina é executada diretamente pela fiber atual.
+
+*/
+void * fiber_offload(void *(*routine)(void *), void *arg);
+
+/*
+    fiber_post
+    ----------
+
+    Envia, de qualquer thread, uma tarefa para ser executada por uma nova
+    fiber, que executará routine(arg). O envio não usa locks(apenas um 
+    compare-and-swap), e o escalonador da primeira thread que começou a
+    executar fibers insere a fiber na sua próxima troca de fiber, mesmo
+    que seja uma preempção, sendo acordado caso esteja ocioso.
+
+    A fiber criada não é joinable, e seu id não é informado. As tarefas
+    só são executadas depois que as fibers começarem a executar.
+
+*/
+int fiber_post(void *(*routine)(void *), void *arg);
+
+/*
+    generator_create
+    ----------------
+
+    Cria um generator cuja fiber produtora executará routine(arg). A 
+    rotina só começa a executar na primeira chamada à generator_next(),
+    e passa cada valor produzido para o consumidor com a 
+    fiber_yield_value(). O generator termina quando a rotina retorna
+    ou chama fiber_exit(). O generator deve ser liberado com a 
+    generator_destroy().
+
+    Cada valor é transferido com uma única troca de contexto direta 
+    entre o consumidor e o produtor, sem passar pelo escalonador e sem
+    reiniciar o timer: o produtor executa no timeslice do consumidor.
+
+*/
+int generator_create(generator_t **gen, void *(*routine)(void *), void *arg);
+
+/*
+    generator_next
+    --------------
+
+    Passa a CPU diretamente para o produtor do generator, até que ele
+    produza o próximo valor, que é transferido para *value(caso value
+    não seja NULL). Retorna ERR_DONE caso o produtor já tenha terminado
+    ou termine sem produzir um valor.
+
+*/
+int generator_next(generator_t *gen, void **value);
+
+/*
+    fiber_yield_value
+    -----------------
+
+    Chamada pelo produtor de um generator: passa value para o consumidor
+    e devolve a CPU diretamente para ele. Retorna quando o consumidor 
+    pedir o próximo valor. Retorna ERR_NOTFOUND caso a fiber atual não
+    seja o produtor de um generator.
+
+*/
+int fiber_yield_value(void *value);
+
+/*
+    generator_destroy
+    -----------------
+
+    Libera o generator. Caso o produtor ainda não tenha terminado, ele
+    é encerrado sem voltar a executar. Retorna ERR_NOTREADY caso o 
+    produtor esteja executando, isto é, caso alguma generator_next() 
+    ainda não tenha retornado.
+
+*/
+int generator_destroy(generator_t *gen);
+
+/*
+    fiber_wait
+    ----------
+
+    Caso *addr ainda seja igual a expected, para a fiber atual até que
+    outra fiber chame fiber_wake(addr, n), com a mesma semântica do 
+    futex do Linux. A comparação e a parada são atômicas em relação às
+    demais fibers. Caso *addr seja diferente de expected, retorna 
+    ERR_AGAIN imediatamente.
+
+    A espera não faz nenhuma alocação e não altera o timer.
+
+*/
+int fiber_wait(int *addr, int expected);
+
+/*
+    fiber_wake
+    ----------
+
+    Acorda até n fibers paradas na fiber_wait() no endereço addr, na 
+    ordem em que pararam. Retorna a quantidade de fibers acordadas.
+
+*/
+int fiber_wake(int *addr, int n);
+
+/*
+    fiber_metrics_start
+    -------------------
+
+    Cria o segmento de memória compartilhada name(shm_open, por exemplo
+    "/fiberlib", visível em /dev/shm) com uma página FiberMetrics, na 
+    qual o escalonador da thread atual passa a publicar os contadores do
+    seu runtime a cada 100ms, sob um seqlock. Caso name seja NULL, o 
+    nome "/fiberlib.<tid>" é usado(o tid da thread principal é o pid do
+    processo). A página pode ser lida pelo fibertop.
+
+*/
+int fiber_metrics_start(const char *name);
+
+/*
+    fiber_metrics_stop
+    ------------------
+
+    Para a publicação das métricas e remove o segmento compartilhado.
+
+*/
+void fiber_metrics_stop();
+
+/*
+    fiber_latency_start
+    -------------------
+
+    Liga os histogramas de latência do escalonador da thread atual. 
+    Desligados(o padrão), eles não custam nenhuma leitura de relógio 
+    nas trocas de fiber. Retorna ERR_EXISTS caso já estejam ligados.
+
+*/
+int fiber_latency_start();
+
+/*
+    fiber_latency_stop
+    ------------------
+
+    Desliga os histogramas de latência da thread atual e descarta as 
+    medidas.
+
+*/
+void fiber_latency_stop();
+
+/*
+    fiber_latency_percentile
+    ------------------------
+
+    Obtém, em nanossegundos, o percentil percentile(entre 0 e 100) de um
+    dos histogramas de latência mantidos pelo escalonador da thread atual
+    desde a fiber_latency_start():
+
+        FIBER_LATENCY_READY: tempo entre uma fiber ficar pronta(criada,
+        preemptada, acordada de um join, da fiber_offload ou da 
+        fiber_wait) e voltar a executar;
+
+        FIBER_LATENCY_JOIN: tempo entre o término da fiber aguardada e
+        o retorno do join;
+
+        FIBER_LATENCY_SLICE: tempo de cada fatia de execução das fibers,
+        até a preempção ou até a fiber ceder a CPU. É medido no relógio
+        de parede(CLOCK_MONOTONIC), e inclui o tempo em que a thread 
+        ficou bloqueada ou sem o processador.
+
+    Os histogramas usam buckets logarítmicos, com erro relativo de no
+    máximo 6,25%. Caso o histograma não tenha nenhuma medida, *ns 
+    recebe 0. Retorna ERR_NOTFOUND caso os histogramas estejam 
+    desligados.
+
+*/
+int fiber_latency_percentile(int histogram, double percentile, uint64_t *ns);
+
+/*
+    fiber_latency_stats
+    -------------------
+
+    Preenche stats com a quantidade de medidas, os percentis 50, 99 e 
+    99,9 e a maior medida de um dos histogramas de latência.
+
+*/
+int fiber_latency_stats(int histogram, FiberLatency *stats);
+
+/*
+    fiber_latency_reset
+    -------------------
+
+    Zera os histogramas de latência da thread atual. Chamada a cada 
+    intervalo de coleta, faz com que as consultas cubram apenas o 
+    intervalo seguinte.
+
+*/
+void fiber_latency_reset();
+
+/*
+    fiber_set_limits
+    ----------------
+
+    Define os limites do controle de admissão da thread atual: no 
+    máximo maxFibers fibers vivas(criadas e ainda não destruídas) e no
+    máximo maxStackBytes bytes de pilha, contando FIBER_STACK bytes por
+    fiber viva, mesmo que ela ainda não tenha executado. Zero desativa
+    o limite correspondente. Retorna ERR_SIZE caso maxFibers seja 
+    negativo ou maxStackBytes seja menor que uma pilha.
+
+    Com um limite atingido, a fiber_create() e suas variações param a
+    fiber atual até que alguma fiber seja destruída. Cuidado: caso a
+    fiber parada seja a única que daria join nas fibers que ocupam os
+    limites, ou a única que as faria terminar, ela nunca é acordada.
+
+*/
+int fiber_set_limits(int maxFibers, size_t maxStackBytes);
+
+/*
+    fiber_try_create
+    ----------------
+
+    Igual à fiber_create(), mas caso os limites da fiber_set_limits() 
+    estejam atingidos, retorna ERR_BUSY imediatamente ao invés de 
+    esperar.
+
+*/
+int fiber_try_create(fiber_t *fiber, void *(*start_routine) (void *), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,242 @@
+/*
+    FiberLib para C++
+    -----------------
+
+    Camada header-only(C++17) sobre a fiber_create_closure() e a fiber_join():
+
+        auto f = fiberlib::spawn([&]{ return calcula(x); });
+        int resultado = f.join();
+
+    A closure recebida pela spawn() é movida(ou copiada) para o topo da
+    pilha da nova fiber, sem nenhuma alocação extra, e é destruída pela
+    própria fiber antes de ela terminar. O valor retornado por ela é
+    devolvido por valor pela join(): valores trivialmente copiáveis de
+    até FIBER_INLINE_RETVAL bytes passam pelo valor de retorno inline da
+    fiber(fiber_exit_value), e os demais são alocados na heap e liberados
+    pela própria join().
+
+    fiber<T> pode ser apenas movida. Caso seja destruída sem que join()
+    tenha sido chamada, a fiber é desanexada(fiber_detach) e seu valor de
+    retorno é destruído pela biblioteca.
+
+    Exceções não podem sair da closure: caso isso aconteça, std::terminate()
+    é chamada.
+*/
+
+#ifndef FIBER_HPP
+#define FIBER_HPP
+
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "fiber.h"
+
+namespace fiberlib {
+
+/*
+    fiber_error
+    -----------
+
+    Exceção lançada quando uma rotina da biblioteca retorna um erro.
+    code() contém o código de erro(ERR_MALL, ERR_NOTFOUND, ...).
+*/
+class fiber_error : public std::runtime_error {
+public:
+    explicit fiber_error(int code)
+        : std::runtime_error("erro " + std::to_string(code) + " na FiberLib"), code_(code) {}
+
+    int code() const noexcept { return code_; }
+
+private:
+    int code_;
+};
+
+namespace detail {
+
+// Indica se um valor de retorno do tipo T passa pelo valor de retorno inline da fiber
+template <typename T, typename = void>
+constexpr bool inline_result = false;
+
+template <typename T>
+constexpr bool inline_result<T, typename std::enable_if<!std::is_void<T>::value>::type> =
+    std::is_trivially_copyable<T>::value && sizeof(T) <= FIBER_INLINE_RETVAL;
+
+// Indica se um valor de retorno do tipo T precisa ser alocado na heap
+template <typename T>
+constexpr bool heap_result = !std::is_void<T>::value && !inline_result<T>;
+
+inline void check(int err) {
+    if (err != 0)
+        throw fiber_error(err);
+}
+
+/*
+    construct
+    ---------
+
+    Rotina init da fiber_create_closure(): constrói a closure no topo
+    da pilha da fiber, a partir da closure recebida pela spawn().
+*/
+template <typename F>
+void construct(void *storage, void *ctx) {
+    using Fn = typename std::decay<F>::type;
+    new (storage) Fn(std::forward<F>(*static_cast<typename std::remove_reference<F>::type *>(ctx)));
+}
+
+/*
+    dispose
+    -------
+
+    Destrói um valor de retorno que nenhum join recebeu. Valores inline
+    não precisam ser destruídos, mas a rotina continua sendo passada para
+    a fiber_create_closure(), que só mantém a fiber até o join quando ela
+    não é NULL. É chamada quando a fiber é destruída, o que a biblioteca
+    só faz fora do tratador do SIGVTALRM(em uma troca de contexto 
+    voluntária ou na destruição do runtime): o delete nunca executa 
+    dentro de uma preempção.
+*/
+template <typename T>
+void dispose(void *retval) {
+    if constexpr (heap_result<T>)
+        delete static_cast<T *>(retval);
+    else
+        (void) retval;
+}
+
+/*
+    run
+    ---
+
+    Rotina executada pela fiber: chama a closure, destrói a closure e
+    termina a fiber com o valor retornado. Nenhum objeto com destrutor
+    pode continuar vivo quando fiber_exit() é chamada, já que ela não
+    retorna.
+*/
+template <typename Fn, typename T>
+void *run(void *storage) noexcept {
+    Fn *fn = static_cast<Fn *>(storage);
+
+    if constexpr (std::is_void<T>::value) {
+        (*fn)();
+        fn->~Fn();
+        fiber_exit(nullptr);
+    } else if constexpr (inline_result<T>) {
+        T result = (*fn)();
+        fn->~Fn();
+        fiber_exit_value(&result, sizeof(T));
+    } else {
+        T *result = new T((*fn)());
+        fn->~Fn();
+        fiber_exit(result);
+    }
+    return nullptr;
+}
+
+} // namespace detail
+
+/*
+    fiber
+    -----
+
+    Handle de uma fiber criada pela spawn(), cuja closure retorna T.
+*/
+template <typename T>
+class fiber {
+public:
+    fiber() noexcept : id_(0), joinable_(false) {}
+
+    explicit fiber(fiber_t id) noexcept : id_(id), joinable_(true) {}
+
+    fiber(fiber &&other) noexcept : id_(other.id_), joinable_(other.joinable_) {
+        other.joinable_ = false;
+    }
+
+    fiber &operator=(fiber &&other) noexcept {
+        if (this != &other) {
+            detach();
+            id_ = other.id_;
+            joinable_ = other.joinable_;
+            other.joinable_ = false;
+        }
+        return *this;
+    }
+
+    fiber(const fiber &) = delete;
+    fiber &operator=(const fiber &) = delete;
+
+    ~fiber() { detach(); }
+
+    // Id da fiber na biblioteca
+    fiber_t id() const noexcept { return id_; }
+
+    // Indica se join() ainda pode ser chamada
+    bool joinable() const noexcept { return joinable_; }
+
+    // Desanexa a fiber: ela será destruída ao terminar, junto com seu valor de retorno
+    void detach() noexcept {
+        if (joinable_) {
+            fiber_detach(id_);
+            joinable_ = false;
+        }
+    }
+
+    // Espera o término da fiber e retorna o valor retornado pela closure
+    T join() {
+        if (!joinable_)
+            throw fiber_error(ERR_NOTFOUND);
+        joinable_ = false;
+
+        if constexpr (std::is_void<T>::value) {
+            detail::check(fiber_join(id_, nullptr));
+        } else if constexpr (detail::inline_result<T>) {
+            alignas(T) unsigned char value[sizeof(T)];
+            detail::check(fiber_join_value(id_, value, sizeof(T)));
+            T result;
+            std::memcpy(static_cast<void *>(&result), value, sizeof(T));
+            return result;
+        } else {
+            void *retval = nullptr;
+            detail::check(fiber_join(id_, &retval));
+            std::unique_ptr<T> owner(static_cast<T *>(retval));
+            return std::move(*owner);
+        }
+    }
+
+private:
+    fiber_t id_;
+    bool joinable_;
+};
+
+/*
+    spawn
+    -----
+
+    Cria uma fiber que executa a closure f(sem argumentos). A closure é
+    guardada no topo da pilha da nova fiber. Lança fiber_error caso a
+    fiber não possa ser criada.
+*/
+template <typename F>
+fiber<typename std::invoke_result<typename std::decay<F>::type &>::type> spawn(F &&f) {
+    using Fn = typename std::decay<F>::type;
+    using T = typename std::invoke_result<Fn &>::type;
+
+    static_assert(alignof(Fn) <= CLOSURE_ALIGN, "closure com alinhamento maior que CLOSURE_ALIGN");
+    static_assert(!detail::inline_result<T> || std::is_default_constructible<T>::value,
+                  "valores de retorno inline devem ter construtor padrão");
+
+    fiber_t id = 0;
+    void *ctx = const_cast<void *>(static_cast<const volatile void *>(std::addressof(f)));
+
+    detail::check(fiber_create_closure(&id, &detail::run<Fn, T>, sizeof(Fn), &detail::construct<F>, ctx,
+                                       &detail::dispose<T>));
+    return fiber<T>(id);
+}
+
+} // namespace fiberlib
+
+#endif
@@ -0,0 +1,112 @@
+/*
+    fibertop
+    --------
+
+    Lê a página de métricas publicada por um processo com a
+    fiber_metrics_start() e imprime os contadores do runtime a cada
+    intervalo. A leitura segue o seqlock da página: ela é copiada
+    entre duas leituras iguais e pares do contador seq. Quando a 
+    página é marcada como parada, os contadores finais são impressos
+    e o fibertop termina.
+
+    Uso: fibertop /fiberlib.<tid> [intervalo em ms] [leituras]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "fiber.h"
+
+/*
+    readMetrics
+    -----------
+
+    Copia uma versão consistente da página compartilhada para snapshot.
+
+*/
+void readMetrics(const FiberMetrics * page, FiberMetrics * snapshot){
+    uint64_t before, after;
+
+    for(;;){
+        before = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+        // Escrita em andamento
+        if(before & 1)
+            continue;
+
+        memcpy(snapshot, (const void *) page, sizeof(FiberMetrics));
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&page->seq, __ATOMIC_RELAXED);
+        if(before == after)
+            return;
+    }
+}
+
+int main(int argc, char ** argv){
+
+    FiberMetrics snapshot;
+    long interval = 1000;
+    long count = -1;
+
+    if(argc < 2 || argc > 4){
+        fprintf(stderr, "Uso: %s /fiberlib.<tid> [intervalo em ms] [leituras]\n", argv[0]);
+        return 1;
+    }
+    if(argc >= 3)
+        interval = atol(argv[2]);
+    if(argc == 4)
+        count = atol(argv[3]);
+
+    int fd = shm_open(argv[1], O_RDONLY, 0);
+    if(fd == -1){
+        perror("erro shm_open na fibertop");
+        return 1;
+    }
+
+    const FiberMetrics * page = mmap(NULL, sizeof(FiberMetrics), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(page == MAP_FAILED){
+        perror("erro mmap na fibertop");
+        return 1;
+    }
+
+    if(memcmp(page->magic, METRICS_MAGIC, sizeof(page->magic)) != 0){
+        fprintf(stderr, "%s não é uma página gerada pela fiber_metrics_start\n", argv[1]);
+        return 1;
+    }
+
+    printf("%8s %8s %8s %8s %12s %10s %12s %10s\n",
+           "pid", "fibers", "ready", "join", "switches", "switch/s", "preemptions", "stack(kB)");
+
+    while(count != 0){
+        readMetrics(page, &snapshot);
+
+        printf("%8llu %8llu %8llu %8llu %12llu %10llu %12llu %10llu\n",
+               (unsigned long long) snapshot.pid,
+               (unsigned long long) snapshot.liveFibers,
+               (unsigned long long) snapshot.readyFibers,
+               (unsigned long long) snapshot.joinWaiting,
+               (unsigned long long) snapshot.switches,
+               (unsigned long long) snapshot.switchesPerSec,
+               (unsigned long long) snapshot.preemptions,
+               (unsigned long long) snapshot.stackBytes / 1024);
+        fflush(stdout);
+
+        if(snapshot.stopped){
+            printf("publicação terminada\n");
+            break;
+        }
+
+        if(count > 0)
+            count--;
+        if(count != 0)
+            usleep(interval * 1000);
+    }
+
+    munmap((void *) page, sizeof(FiberMetrics));
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+    fibertrace
+    ----------
+
+    Converte um arquivo gerado pela fiber_trace_dump() para o formato
+    JSON de traces do Chrome(chrome://tracing) e do Perfetto(ui.perfetto.dev).
+    Cada fiber aparece como uma thread(tid = id da fiber), e cada período
+    em que ela ocupou a CPU aparece como uma fatia que termina com o
+    motivo da sua saída.
+
+    Uso: fibertrace trace.bin > trace.json
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fiber.h"
+
+/*
+    toMicroseconds
+    --------------
+
+    Converte um timestamp do tracer para microssegundos a partir do
+    início do trace, usando os valores de calibração do cabeçalho.
+
+*/
+double toMicroseconds(TraceHeader * header, uint64_t timestamp){
+    double ticks = (double) (header->ticksEnd - header->ticksStart);
+    double ns = (double) (header->nsEnd - header->nsStart);
+    double nsPerTick = ticks > 0 ? ns / ticks : 1.0;
+
+    return ((double) (int64_t) (timestamp - header->ticksStart)) * nsPerTick / 1000.0;
+}
+
+/*
+    reasonName
+    ----------
+
+    Retorna o nome do motivo de um evento TRACE_SWITCH_OUT.
+
+*/
+const char * reasonName(int reason){
+    switch(reason){
+        case TRACE_PREEMPTED: return "preempted";
+        case TRACE_JOINED:    return "join";
+        case TRACE_EXITED:    return "exit";
+        case TRACE_OFFLOADED: return "offload";
+        case TRACE_HANDOFF:   return "handoff";
+        case TRACE_PARKED:    return "park";
+        default:              return "unknown";
+    }
+}
+
+/*
+    eventName
+    ---------
+
+    Retorna o nome dos eventos instantâneos.
+
+*/
+const char * eventName(int type){
+    switch(type){
+        case TRACE_CREATE:     return "create";
+        case TRACE_EXIT:       return "exit";
+        case TRACE_JOIN_BLOCK: return "join-block";
+        case TRACE_WAKE:       return "wake";
+        default:               return "unknown";
+    }
+}
+
+int main(int argc, char ** argv){
+
+    TraceHeader header;
+    TraceEvent event;
+    uint64_t i;
+    int first = 1;
+
+    if(argc != 2){
+        fprintf(stderr, "Uso: %s trace.bin > trace.json\n", argv[0]);
+        return 1;
+    }
+
+    FILE * file = fopen(argv[1], "rb");
+    if(file == NULL){
+        perror("erro fopen na fibertrace");
+        return 1;
+    }
+
+    // Lendo e validando o cabeçalho
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0){
+        fprintf(stderr, "%s não é um arquivo gerado pela fiber_trace_dump\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    if(header.lost > 0)
+        fprintf(stderr, "%llu eventos foram sobrescritos antes da gravação\n", (unsigned long long) header.lost);
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    for(i = 0; i < header.nEvents; i++){
+        if(fread(&event, sizeof(event), 1, file) != 1){
+            fprintf(stderr, "arquivo truncado no evento %llu\n", (unsigned long long) i);
+            break;
+        }
+
+        double ts = toMicroseconds(&header, event.timestamp);
+
+        if(!first)
+            printf(",\n");
+        first = 0;
+
+        // Entradas e saídas delimitam as fatias de execução de cada fiber
+        if(event.type == TRACE_SWITCH_IN)
+            printf("{\"name\":\"fiber %d\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+                   event.fiberId, event.fiberId, ts);
+        else if(event.type == TRACE_SWITCH_OUT)
+            printf("{\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"reason\":\"%s\"}}",
+                   event.fiberId, ts, reasonName(event.reason));
+        // Os demais eventos são instantâneos
+        else
+            printf("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}",
+                   eventName(event.type), event.fiberId, ts);
+    }
+
+    printf("\n]}\n");
+
+    fclose(file);
+    return 0;
+}
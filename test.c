@@ -1,9 +1,14 @@
 #include <stdio.h>
 #include <ucontext.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
 #include "fiber.h"
 
-#define NUM_FIBER 11
+#define NUM_FIBER 13
 
 fiber_t fibers[NUM_FIBER];
 ucontext_t parent, child;
@@ -106,10 +111,554 @@ void *threadFunction10(void * c) {
     fiber_exit(retval);
 }
 
+typedef struct Par{
+    int a;
+    long long int b;
+} Par;
+
+void *threadFunction12(void * c) {
+    Par joinRetval;
+    printf("Thread 12 começou e deu join por valor na thread 13.\n\n");
+    fiber_join_value(fibers[12], &joinRetval, sizeof(joinRetval));
+    printf("Thread 12 retornou do join. Valor de retorno da thread 13: (%d, %lld).\n\n", joinRetval.a, joinRetval.b);
+    if(joinRetval.a != 13 || joinRetval.b != 1300000000000LL){
+        printf("FALHOU: fiber_join_value não recebeu o valor da thread 13.\n");
+        exit(1);
+    }
+    fiber_exit(NULL);
+}
+
+void *threadFunction13(void * c) {
+    Par retval = { 13, 1300000000000LL };
+    printf("Thread 13 começou e terminará agora, retornando (13, 1300000000000) por valor.\n\n");
+    fiber_exit_value(&retval, sizeof(retval));
+}
+
+/*
+    Verificações automáticas
+    ------------------------
+
+    Executadas pela thread principal antes da demonstração. Cada uma
+    imprime "ok: <descrição>", ou "FALHOU: <descrição>" e encerra o
+    processo com código 1.
+
+*/
+void check(int ok, const char * what) {
+    if(!ok){
+        printf("FALHOU: %s\n", what);
+        exit(1);
+    }
+    printf("ok: %s\n", what);
+}
+
+// Rotina e argumento de uma fiber criada pela spawn
+typedef struct Call{
+    void *(*routine)(void *);
+    void * arg;
+} Call;
+
+void initCall(void * storage, void * ctx) {
+    *(Call *) storage = *(Call *) ctx;
+}
+
+void *runCall(void * storage) {
+    Call * call = (Call *) storage;
+    return call->routine(call->arg);
+}
+
+void keepRetval(void * retval) {
+    // Os valores de retorno das verificações não são alocados
+}
+
+// Cria uma fiber joinable: o join funciona mesmo depois que ela terminar
+int spawn(fiber_t * fiber, void *(*routine)(void *), void * arg) {
+    Call call = { routine, arg };
+    *fiber = 0;
+    return fiber_create_closure(fiber, runCall, sizeof(Call), initCall, &call, keepRetval);
+}
+
+volatile int offloadDone = 0;
+volatile long long int offloadTicks = 0;
+
+void *blockingCall(void * arg) {
+    usleep(20000);
+    return (char *) arg + 1;
+}
+
+void *offloadingFiber(void * arg) {
+    void * retval = fiber_offload(blockingCall, arg);
+    offloadDone = 1;
+    fiber_exit(retval);
+}
+
+void *tickingFiber(void * arg) {
+    while(!offloadDone)
+        offloadTicks++;
+    fiber_exit(NULL);
+}
+
+void checkOffload() {
+    static char buffer[2];
+    fiber_t offloading, ticking;
+    void * retval = NULL;
+
+    spawn(&offloading, offloadingFiber, buffer);
+    spawn(&ticking, tickingFiber, NULL);
+    fiber_join(offloading, &retval);
+    fiber_join(ticking, NULL);
+    check(retval == buffer + 1, "fiber_offload devolve o retorno da rotina bloqueante");
+    check(offloadTicks > 0, "fibers continuam executando durante a fiber_offload");
+}
+
+int postedRuns = 0;
+
+void *postedTask(void * arg) {
+    postedRuns++;
+    fiber_wake(&postedRuns, 1);
+    return NULL;
+}
+
+void *emptyFiber(void * arg) {
+    return arg;
+}
+
+volatile int spinPosted = 0;
+
+void *spinPostedTask(void * arg) {
+    spinPosted = 1;
+    return NULL;
+}
+
+void *spinningUntilPosted(void * arg) {
+    while(!spinPosted)
+        ;
+    return NULL;
+}
+
+void checkPost() {
+    fiber_t other, spinner;
+
+    check(fiber_post(postedTask, NULL) == 0, "fiber_post aceita uma tarefa");
+    while(postedRuns == 0)
+        fiber_wait(&postedRuns, 0);
+
+    // Dando ao escalonador a chance de executar a tarefa de novo
+    spawn(&other, emptyFiber, NULL);
+    fiber_join(other, NULL);
+    check(postedRuns == 1, "uma tarefa da fiber_post que retorna executa uma única vez");
+
+    // Só fibers que consomem CPU estão prontas: a tarefa só pode chegar por uma preempção
+    spawn(&spinner, spinningUntilPosted, NULL);
+    fiber_post(spinPostedTask, NULL);
+    while(!spinPosted)
+        ;
+    fiber_join(spinner, NULL);
+    check(1, "tarefas da fiber_post executam mesmo quando só há fibers consumindo CPU");
+}
+
+int returnedValue = 34;
+
+void *returningFiber(void * arg) {
+    return &returnedValue;
+}
+
+void *joiningFiber(void * arg) {
+    void * retval = NULL;
+    fiber_join(*(fiber_t *) arg, &retval);
+    return retval;
+}
+
+void checkReturn() {
+    fiber_t returning, joining;
+    void * retval = NULL, * joinedRetval = NULL;
+
+    // joining começa a executar antes e fica no join de returning
+    spawn(&joining, joiningFiber, &returning);
+    spawn(&returning, returningFiber, NULL);
+    fiber_join(returning, &retval);
+    fiber_join(joining, &joinedRetval);
+    check(retval == &returnedValue, "o valor retornado pela rotina chega ao join");
+    check(joinedRetval == &returnedValue, "todas as fibers no join de uma rotina que retorna são retomadas");
+}
+
+void *countingProducer(void * arg) {
+    long int n = (long int) arg;
+    for(long int i = 1; i <= n; i++)
+        fiber_yield_value((void *) i);
+    return NULL;
+}
+
+void checkGenerators() {
+    generator_t * gen;
+    void * value;
+    long int count = 0;
+    int ordered = 1;
+
+    generator_create(&gen, countingProducer, (void *) 5L);
+    while(generator_next(gen, &value) == 0)
+        if((long int) value != ++count)
+            ordered = 0;
+    check(ordered && count == 5, "generator_next recebe os valores produzidos em ordem");
+    check(generator_next(gen, &value) == ERR_DONE, "generator_next retorna ERR_DONE depois que o produtor retorna");
+    check(generator_destroy(gen) == 0, "generator_destroy libera um generator terminado");
+
+    generator_create(&gen, countingProducer, (void *) 1000L);
+    generator_next(gen, &value);
+    check(generator_destroy(gen) == 0, "generator_destroy encerra um produtor suspenso");
+    check(fiber_yield_value(NULL) == ERR_NOTFOUND, "fiber_yield_value fora de um produtor retorna ERR_NOTFOUND");
+}
+
+int waitWord = 0;
+int wakeOrder[3];
+int nWoken = 0;
+
+void *parkingFiber(void * arg) {
+    fiber_wait(&waitWord, 0);
+    wakeOrder[nWoken++] = (int) (long int) arg;
+    return NULL;
+}
+
+void checkWaitWake() {
+    fiber_t parking[3], other;
+
+    check(fiber_wait(&waitWord, 1) == ERR_AGAIN, "fiber_wait retorna ERR_AGAIN quando o valor já mudou");
+    check(fiber_wake(&waitWord, 1) == 0, "fiber_wake sem fibers paradas não acorda nenhuma");
+
+    for(long int i = 0; i < 3; i++)
+        spawn(&parking[i], parkingFiber, (void *) i);
+    // As três param antes de other terminar
+    spawn(&other, emptyFiber, NULL);
+    fiber_join(other, NULL);
+    check(nWoken == 0, "fiber_wait para as fibers até a fiber_wake");
+
+    check(fiber_wake(&waitWord, 2) == 2, "fiber_wake acorda no máximo n fibers");
+    fiber_join(parking[0], NULL);
+    fiber_join(parking[1], NULL);
+    check(nWoken == 2 && wakeOrder[0] == 0 && wakeOrder[1] == 1, "fiber_wake acorda as fibers na ordem em que pararam");
+
+    check(fiber_wake(&waitWord, 5) == 1, "fiber_wake retorna a quantidade de fibers acordadas");
+    fiber_join(parking[2], NULL);
+    check(nWoken == 3, "todas as fibers paradas são retomadas");
+}
+
+void checkMetrics() {
+    const FiberMetrics * page = MAP_FAILED;
+
+    check(fiber_metrics_start("/fiberlib.test") == 0, "fiber_metrics_start cria a página de métricas");
+    int fd = shm_open("/fiberlib.test", O_RDONLY, 0);
+    if(fd != -1){
+        page = (const FiberMetrics *) mmap(NULL, sizeof(FiberMetrics), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    check(page != MAP_FAILED && page->timestamp != 0 && page->liveFibers >= 1, "a página tem contadores logo após a fiber_metrics_start");
+
+    fiber_metrics_stop();
+    check(page->stopped != 0, "fiber_metrics_stop marca a página como parada");
+    munmap((void *) page, sizeof(FiberMetrics));
+}
+
+#define LAZY_FIBERS 100
+#define PREEMPTED_FIBERS 8
+
+int lazyRuns = 0;
+
+void *lazyFiber(void * arg) {
+    lazyRuns++;
+    fiber_wake(&lazyRuns, 1);
+    return NULL;
+}
+
+void checkLazy() {
+    fiber_t lazy;
+    const FiberMetrics * page = MAP_FAILED;
+    uint64_t stackBytes = 0;
+
+    // Fibers da fiber_create(as da fiber_create_closure precisam da pilha desde a criação)
+    for(int i = 0; i < LAZY_FIBERS; i++)
+        fiber_create((lazy = 0, &lazy), lazyFiber, NULL);
+
+    // A fiber_metrics_start publica os contadores na hora
+    fiber_metrics_start("/fiberlib.lazy");
+    int fd = shm_open("/fiberlib.lazy", O_RDONLY, 0);
+    if(fd != -1){
+        page = (const FiberMetrics *) mmap(NULL, sizeof(FiberMetrics), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if(page != MAP_FAILED){
+        stackBytes = page->stackBytes;
+        munmap((void *) page, sizeof(FiberMetrics));
+    }
+    fiber_metrics_stop();
+    check(page != MAP_FAILED && stackBytes < LAZY_FIBERS / 2 * FIBER_STACK, "fibers que ainda não executaram não têm pilha");
+
+    while(lazyRuns < LAZY_FIBERS)
+        fiber_wait(&lazyRuns, lazyRuns);
+    check(lazyRuns == LAZY_FIBERS, "as pilhas são montadas quando as fibers executam");
+
+    // Sem nenhuma troca voluntária da thread principal, só as preempções despacham as fibers
+    lazyRuns = 0;
+    for(int i = 0; i < PREEMPTED_FIBERS; i++)
+        fiber_create((lazy = 0, &lazy), lazyFiber, NULL);
+    while(*(volatile int *) &lazyRuns < PREEMPTED_FIBERS)
+        ;
+    check(1, "preempções despacham fibers que ainda não têm pilha");
+}
+
+void checkLatency() {
+    FiberLatency stats;
+    uint64_t ns;
+    fiber_t other;
+
+    check(fiber_latency_stats(FIBER_LATENCY_READY, &stats) == ERR_NOTFOUND, "consultas de latência retornam ERR_NOTFOUND com as medidas desligadas");
+
+    check(fiber_latency_start() == 0, "fiber_latency_start liga os histogramas");
+    check(fiber_latency_start() == ERR_EXISTS, "fiber_latency_start retorna ERR_EXISTS com os histogramas ligados");
+    for(int i = 0; i < 10; i++){
+        spawn(&other, emptyFiber, NULL);
+        fiber_join(other, NULL);
+    }
+    check(fiber_latency_stats(FIBER_LATENCY_READY, &stats) == 0 && stats.count > 0, "as trocas de fiber são medidas com os histogramas ligados");
+    check(fiber_latency_percentile(FIBER_LATENCY_SLICE, 50.0, &ns) == 0 && fiber_latency_percentile(FIBER_LATENCY_SLICE, 101.0, &ns) == ERR_SIZE, "fiber_latency_percentile valida o percentil");
+
+    fiber_latency_stop();
+    check(fiber_latency_percentile(FIBER_LATENCY_READY, 50.0, &ns) == ERR_NOTFOUND, "fiber_latency_stop desliga os histogramas");
+}
+
+int limitWord = 0;
+
+void *limitedFiber(void * arg) {
+    while(limitWord == 0)
+        fiber_wait(&limitWord, 0);
+    return NULL;
+}
+
+void checkLimits() {
+    fiber_t first = 0, second = 0, created = 0, other;
+    generator_t * gen = NULL;
+    void * value;
+    long int count = 0;
+
+    check(fiber_set_limits(-1, 0) == ERR_SIZE && fiber_set_limits(0, 1) == ERR_SIZE, "fiber_set_limits rejeita limites inválidos");
+
+    // As duas param antes de other terminar
+    fiber_create(&first, limitedFiber, NULL);
+    fiber_create(&second, limitedFiber, NULL);
+    spawn(&other, emptyFiber, NULL);
+    fiber_join(other, NULL);
+
+    check(fiber_set_limits(1, 0) == 0, "fiber_set_limits aceita um limite de fibers");
+    check(fiber_try_create(&created, emptyFiber, NULL) == ERR_BUSY, "fiber_try_create retorna ERR_BUSY com o limite atingido");
+
+    // O generator espera uma vaga, que só é liberada quando as fibers paradas terminarem
+    limitWord = 1;
+    fiber_wake(&limitWord, 2);
+    check(generator_create(&gen, countingProducer, (void *) 3L) == 0, "generator_create espera uma vaga com o limite atingido");
+    while(generator_next(gen, &value) == 0)
+        count++;
+    check(count == 3 && generator_destroy(gen) == 0, "o generator criado sob os limites produz todos os valores");
+
+    check(fiber_set_limits(0, 0) == 0 && fiber_try_create((created = 0, &created), emptyFiber, NULL) == 0, "fiber_set_limits(0, 0) desativa os limites");
+}
+
+#define ARENA_BLOCK 256
+
+char * arenaFirst[2];
+int arenaAligned = 1, arenaChained = 0;
+
+void *arenaFiber(void * arg) {
+    char * small = (char *) fiber_alloc(3);
+    char * aligned = (char *) fiber_alloc(100);
+    // Não cabe no que resta do primeiro bloco
+    char * chained = (char *) fiber_alloc(200);
+
+    arenaAligned = small != NULL && aligned != NULL && chained != NULL && (uintptr_t) aligned % ARENA_ALIGN == 0 && (uintptr_t) chained % ARENA_ALIGN == 0 && aligned >= small + 3;
+    arenaChained = chained != NULL && (chained < small || chained >= small + ARENA_BLOCK);
+    arenaFirst[(long int) arg] = small;
+    return NULL;
+}
+
+void checkArena() {
+    fiber_t arena, other;
+
+    check(fiber_alloc(16) == NULL, "fiber_alloc fora de uma fiber com arena retorna NULL");
+
+    arena = 0;
+    fiber_create_arena(&arena, arenaFiber, (void *) 0L, ARENA_BLOCK);
+    fiber_join(arena, NULL);
+    check(arenaAligned, "fiber_alloc devolve blocos alinhados a ARENA_ALIGN");
+    check(arenaChained, "fiber_alloc obtém um novo bloco quando o atual se esgota");
+
+    // Dando ao escalonador a chance de destruir a fiber e devolver os blocos ao pool
+    spawn(&other, emptyFiber, NULL);
+    fiber_join(other, NULL);
+
+    arena = 0;
+    fiber_create_arena(&arena, arenaFiber, (void *) 1L, ARENA_BLOCK);
+    fiber_join(arena, NULL);
+    check(arenaFirst[1] != NULL && arenaFirst[1] == arenaFirst[0], "os blocos de uma fiber destruída são reaproveitados pela próxima arena");
+}
+
+#define TRACED_FIBERS 3
+
+void checkTrace() {
+    fiber_t traced[TRACED_FIBERS];
+    TraceHeader header;
+    TraceEvent event;
+    int creates = 0, exits = 0, switches = 0, known = 1;
+    uint64_t read = 0;
+
+    check(fiber_trace_dump("/tmp/fiberlib.trace") == ERR_NOTFOUND, "fiber_trace_dump retorna ERR_NOTFOUND com o tracer desligado");
+
+    check(fiber_trace_start(1024) == 0, "fiber_trace_start liga o tracer");
+    for(int i = 0; i < TRACED_FIBERS; i++)
+        spawn(&traced[i], emptyFiber, NULL);
+    for(int i = 0; i < TRACED_FIBERS; i++)
+        fiber_join(traced[i], NULL);
+    check(fiber_trace_dump("/tmp/fiberlib.trace") == 0, "fiber_trace_dump grava os eventos");
+    fiber_trace_stop();
+
+    FILE * file = fopen("/tmp/fiberlib.trace", "rb");
+    if(file != NULL && fread(&header, sizeof(header), 1, file) == 1){
+        for(; read < header.nEvents && fread(&event, sizeof(event), 1, file) == 1; read++){
+            if(event.type < TRACE_CREATE || event.type > TRACE_WAKE || event.reason > TRACE_PARKED)
+                known = 0;
+            for(int i = 0; i < TRACED_FIBERS; i++){
+                if(event.fiberId != traced[i])
+                    continue;
+                creates += event.type == TRACE_CREATE;
+                exits += event.type == TRACE_EXIT;
+                switches += event.type == TRACE_SWITCH_OUT && event.reason == TRACE_EXITED;
+            }
+        }
+    }
+    if(file != NULL)
+        fclose(file);
+    remove("/tmp/fiberlib.trace");
+    check(read > 0 && read == header.nEvents && header.lost == 0, "o arquivo tem a quantidade de eventos do cabeçalho");
+    check(known, "todos os eventos têm tipo e motivo conhecidos");
+    check(creates == TRACED_FIBERS && exits == TRACED_FIBERS && switches == TRACED_FIBERS, "a criação e o fim de cada fiber são registrados");
+}
+
+void *spinningFiber(void * arg) {
+    clock_t start = clock();
+    // Consome CPU sem nenhuma troca voluntária
+    while(clock() - start < CLOCKS_PER_SEC / 5)
+        ;
+    return NULL;
+}
+
+void checkProfile() {
+    fiber_t spinning;
+    char line[4096];
+    int id, attributed = 0;
+
+    check(fiber_profile_start(0, 100) == ERR_NULLID, "fiber_profile_start rejeita uma frequência inválida");
+
+    check(fiber_profile_start(1000, 4096) == 0, "fiber_profile_start liga o profiler");
+    spawn(&spinning, spinningFiber, NULL);
+    fiber_join(spinning, NULL);
+    check(fiber_profile_dump("/tmp/fiberlib.profile") == 0, "fiber_profile_dump grava as amostras");
+
+    FILE * file = fopen("/tmp/fiberlib.profile", "r");
+    while(file != NULL && fgets(line, sizeof(line), file) != NULL)
+        if(sscanf(line, "fiber_%d;", &id) == 1 && id == spinning)
+            attributed = 1;
+    if(file != NULL)
+        fclose(file);
+    remove("/tmp/fiberlib.profile");
+    check(attributed, "as amostras de uma fiber que consome CPU levam o id dela");
+}
+
+#define EXITING_THREADS 20
+#define RUNTIME_THREADS 4
+#define THREAD_FIBERS 5
+
+void *offloadFiber(void * arg) {
+    return fiber_offload(blockingCall, arg);
+}
+
+void *forgottenFiber(void * arg) {
+    int never = 0;
+    fiber_wait(&never, 0);
+    return NULL;
+}
+
+// Retorna sem fiber_exit, com as threads da fiber_offload criadas e uma fiber parada para sempre
+void *returningThread(void * arg) {
+    char buffer[2];
+    fiber_t offloading, forgotten = 0;
+    void * retval = NULL;
+
+    fiber_create(&forgotten, forgottenFiber, NULL);
+    spawn(&offloading, offloadFiber, buffer);
+    fiber_join(offloading, &retval);
+    return retval == buffer + 1 ? arg : NULL;
+}
+
+void *addingFiber(void * arg) {
+    long int * sum = (long int *) arg;
+    for(int i = 0; i < 1000; i++)
+        (*sum)++;
+    return NULL;
+}
+
+// Termina pela fiber_exit da própria thread, depois que as suas fibers terminam
+void *exitingThread(void * arg) {
+    fiber_t adding[THREAD_FIBERS];
+    long int sum = 0;
+
+    for(int i = 0; i < THREAD_FIBERS; i++)
+        spawn(&adding[i], addingFiber, &sum);
+    for(int i = 0; i < THREAD_FIBERS; i++)
+        fiber_join(adding[i], NULL);
+    *(long int *) arg = sum;
+    fiber_exit(NULL);
+    return NULL;
+}
+
+void checkThreads() {
+    pthread_t threads[RUNTIME_THREADS];
+    long int sums[RUNTIME_THREADS];
+    int returned = 0, summed = 0;
+
+    for(int i = 0; i < EXITING_THREADS; i++){
+        pthread_t thread;
+        void * retval = NULL;
+        if(pthread_create(&thread, NULL, returningThread, &returned) == 0 && pthread_join(thread, &retval) == 0 && retval == &returned)
+            returned++;
+    }
+    check(returned == EXITING_THREADS, "threads que retornam sem fiber_exit destroem o seu runtime");
+
+    for(int i = 0; i < RUNTIME_THREADS; i++){
+        sums[i] = 0;
+        if(pthread_create(&threads[i], NULL, exitingThread, &sums[i]) != 0)
+            threads[i] = 0;
+    }
+    for(int i = 0; i < RUNTIME_THREADS; i++)
+        if(threads[i] != 0 && pthread_join(threads[i], NULL) == 0 && sums[i] == THREAD_FIBERS * 1000)
+            summed++;
+    check(summed == RUNTIME_THREADS, "threads executam os seus próprios runtimes ao mesmo tempo");
+}
+
 int main () {
 
     void * arg = NULL;
 	void ** retval = (void **) malloc(sizeof(void *));
+
+    checkOffload();
+    checkPost();
+    checkReturn();
+    checkGenerators();
+    checkWaitWake();
+    checkMetrics();
+    checkLazy();
+    checkThreads();
+    checkLatency();
+    checkLimits();
+    checkProfile();
+    checkTrace();
+    checkArena();
+
     printf("Thread principal começou.\n");
     
     fiber_create(&fibers[0], threadFunction1, arg);
@@ -122,7 +671,9 @@ int main () {
     fiber_create(&fibers[7], threadFunction8, arg);
     fiber_create(&fibers[8], threadFunction9, arg);
     fiber_create(&fibers[9], threadFunction10, arg);
-    printf("Thread principal criou 10 threads.\n");
+    fiber_create(&fibers[11], threadFunction12, arg);
+    fiber_create(&fibers[12], threadFunction13, arg);
+    printf("Thread principal criou 12 threads.\n");
 
 	
     printf("Thread principal deu join na thread 1.\n\n");
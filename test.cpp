@@ -0,0 +1,89 @@
+/*
+    Verificações da camada C++(fiber.hpp)
+    --------------------------------------
+
+    Cada verificação imprime "ok: <descrição>", ou "FALHOU: <descrição>" e
+    encerra o processo com código 1.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "fiber.hpp"
+
+void check(bool ok, const char *what) {
+    if (!ok) {
+        std::printf("FALHOU: %s\n", what);
+        std::exit(1);
+    }
+    std::printf("ok: %s\n", what);
+}
+
+// Conta as instâncias vivas, para detectar valores de retorno vazados ou destruídos duas vezes
+struct Tracked {
+    static int live;
+    std::string name;
+
+    explicit Tracked(std::string n) : name(std::move(n)) { live++; }
+    Tracked(const Tracked &other) : name(other.name) { live++; }
+    Tracked(Tracked &&other) noexcept : name(std::move(other.name)) { live++; }
+    ~Tracked() { live--; }
+};
+
+int Tracked::live = 0;
+
+void checkValues() {
+    int x = 20;
+    auto inlined = fiberlib::spawn([&] { return x + 1; });
+    check(inlined.join() == 21, "join() devolve valores inline");
+
+    auto heap = fiberlib::spawn([] { return std::string(100, 'f'); });
+    check(heap.join() == std::string(100, 'f'), "join() devolve valores alocados na heap");
+
+    int calls = 0;
+    auto nothing = fiberlib::spawn([&] { calls++; });
+    nothing.join();
+    check(calls == 1, "closures sem retorno executam uma única vez");
+}
+
+void checkOwnership() {
+    {
+        std::unique_ptr<int> owned(new int(7));
+        auto moved = fiberlib::spawn([p = std::move(owned)] { return Tracked(std::to_string(*p)); });
+        Tracked result = moved.join();
+        check(result.name == "7", "closures apenas movíveis são guardadas na pilha da fiber");
+    }
+    check(Tracked::live == 0, "valores de retorno recebidos pelo join() são destruídos uma vez");
+
+    fiberlib::fiber<int> first = fiberlib::spawn([] { return 1; });
+    fiberlib::fiber<int> second = std::move(first);
+    check(!first.joinable() && second.joinable(), "fiber<T> transfere o join ao ser movida");
+    second.join();
+
+    bool thrown = false;
+    try {
+        second.join();
+    } catch (const fiberlib::fiber_error &e) {
+        thrown = e.code() == ERR_NOTFOUND;
+    }
+    check(thrown, "um segundo join() lança fiber_error(ERR_NOTFOUND)");
+}
+
+void checkDetach() {
+    fiberlib::spawn([] { return Tracked("desanexada"); });
+
+    // A fiber desanexada é destruída pelo escalonador em alguma das próximas passadas
+    for (int i = 0; i < 100 && Tracked::live != 0; i++)
+        fiberlib::spawn([] {}).join();
+    check(Tracked::live == 0, "o valor de retorno de uma fiber desanexada é destruído");
+}
+
+int main() {
+    checkValues();
+    checkOwnership();
+    checkDetach();
+    fiber_exit(nullptr);
+    return 0;
+}